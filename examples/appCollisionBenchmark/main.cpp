@@ -0,0 +1,372 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <phyanim/Phyanim.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using namespace phyanim;
+
+typedef std::chrono::duration<float, std::milli> Milliseconds;
+
+// Random walks that roughly mimic resampled neurite sections
+void generateChains(uint32_t numChains,
+                    uint32_t numSegments,
+                    float sceneSize,
+                    std::vector<geometry::Edges>& edgesSet,
+                    std::vector<geometry::Nodes>& nodesSet)
+{
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> position(0.0f, sceneSize);
+    std::uniform_real_distribution<float> step(-0.15f, 0.15f);
+
+    edgesSet.resize(numChains);
+    nodesSet.resize(numChains);
+    for (uint32_t i = 0; i < numChains; ++i)
+    {
+        geometry::Vec3 pos(position(generator), position(generator),
+                           position(generator));
+        geometry::Vec3 dir(step(generator), step(generator), step(generator));
+        auto node = new geometry::Node(pos, 0, 0.1f);
+        nodesSet[i].push_back(node);
+        for (uint32_t j = 0; j < numSegments; ++j)
+        {
+            dir = dir * 0.8f +
+                  geometry::Vec3(step(generator), step(generator),
+                                 step(generator));
+            auto next = new geometry::Node(node->position + dir, j + 1, 0.1f);
+            nodesSet[i].push_back(next);
+            edgesSet[i].push_back(new geometry::Edge(node, next));
+            node = next;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t numChains = 200;
+    uint32_t numSegments = 1000;
+    uint32_t numIters = 100;
+    float sceneSize = 50.0f;
+    float margin = 0.0f;
+    std::vector<std::string> files;
+
+    for (uint32_t i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if (arg.compare("-c") == 0)
+        {
+            ++i;
+            numChains = std::stoul(argv[i]);
+        }
+        else if (arg.compare("-s") == 0)
+        {
+            ++i;
+            numSegments = std::stoul(argv[i]);
+        }
+        else if (arg.compare("-i") == 0)
+        {
+            ++i;
+            numIters = std::stoul(argv[i]);
+        }
+        else if (arg.compare("-m") == 0)
+        {
+            ++i;
+            margin = std::atof(argv[i]);
+        }
+        else if (arg.find(".tet") != std::string::npos ||
+                 arg.find(".off") != std::string::npos)
+            files.push_back(arg);
+    }
+
+    std::vector<geometry::Edges> edgesSet;
+    std::vector<geometry::Nodes> nodesSet;
+    geometry::Meshes meshes;
+    geometry::HierarchicalAABBs aabbs;
+
+    auto startTime = std::chrono::steady_clock::now();
+    if (files.empty())
+    {
+        generateChains(numChains, numSegments, sceneSize, edgesSet, nodesSet);
+        aabbs.resize(numChains);
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+        for (uint32_t i = 0; i < numChains; ++i)
+            aabbs[i] = new geometry::HierarchicalAABB(edgesSet[i]);
+    }
+    else
+    {
+        meshes.resize(files.size());
+        aabbs.resize(files.size());
+        nodesSet.resize(files.size());
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+        for (uint32_t i = 0; i < files.size(); ++i)
+        {
+            meshes[i] = new geometry::Mesh();
+            meshes[i]->load(files[i]);
+            aabbs[i] = new geometry::HierarchicalAABB(
+                meshes[i]->surfaceTriangles);
+            nodesSet[i] = meshes[i]->nodes;
+        }
+    }
+    Milliseconds buildTime = std::chrono::steady_clock::now() - startTime;
+
+    if (margin > 0.0f)
+    {
+        for (auto aabb : aabbs)
+        {
+            aabb->margin = margin;
+            aabb->update();
+        }
+    }
+
+    uint64_t numPrimitives = 0;
+    for (auto aabb : aabbs) numPrimitives += aabb->primitives().size();
+    std::cout << "BVHs: " << aabbs.size() << "  Primitives: " << numPrimitives
+              << "  Build time: " << buildTime.count() << " ms" << std::endl;
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+    geometry::SweepAndPrune sweepAndPrune;
+
+    Milliseconds updateTime(0.0f);
+    Milliseconds refitTime(0.0f);
+    Milliseconds traversalTime(0.0f);
+    Milliseconds narrowTime(0.0f);
+    Milliseconds cacheTime(0.0f);
+    uint64_t numPairs = 0;
+    uint64_t numCollisions = 0;
+    uint64_t cacheCollisions = 0;
+    uint64_t refitNodes = 0;
+    uint64_t totalNodes = 0;
+    anim::ContactCache contactCache;
+
+    for (uint32_t iter = 0; iter < numIters; ++iter)
+    {
+        for (auto& nodes : nodesSet)
+        {
+            for (auto node : nodes)
+            {
+                node->position += geometry::Vec3(
+                    jitter(generator), jitter(generator), jitter(generator));
+                node->dirty = true;
+            }
+        }
+
+        startTime = std::chrono::steady_clock::now();
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for reduction(+ : refitNodes, totalNodes)
+#endif
+        for (uint32_t i = 0; i < aabbs.size(); ++i)
+        {
+            refitNodes += aabbs[i]->refit();
+            totalNodes += aabbs[i]->numNodes();
+        }
+        refitTime += std::chrono::steady_clock::now() - startTime;
+
+        startTime = std::chrono::steady_clock::now();
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+        for (uint32_t i = 0; i < aabbs.size(); ++i) aabbs[i]->update();
+        updateTime += std::chrono::steady_clock::now() - startTime;
+
+        for (auto& nodes : nodesSet)
+        {
+            geometry::clearDirty(nodes);
+            geometry::clearForce(nodes);
+            geometry::clearCollision(nodes);
+        }
+
+        startTime = std::chrono::steady_clock::now();
+        auto aabbPairs = sweepAndPrune.collidingPairs(aabbs);
+        for (auto& aabbPair : aabbPairs)
+            aabbs[aabbPair.first]->collidingPrimitives(
+                aabbs[aabbPair.second],
+                [&](const geometry::PrimitivePair* pairs, uint32_t size) {
+                    numPairs += size;
+                });
+        traversalTime += std::chrono::steady_clock::now() - startTime;
+
+        startTime = std::chrono::steady_clock::now();
+        numCollisions += anim::CollisionDetection::computeCollisions(
+            aabbs, 1.0f, 0.1f, &sweepAndPrune);
+        narrowTime += std::chrono::steady_clock::now() - startTime;
+
+        startTime = std::chrono::steady_clock::now();
+        cacheCollisions += contactCache.computeCollisions(aabbs, 1.0f, 0.1f);
+        cacheTime += std::chrono::steady_clock::now() - startTime;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Per step -> Refit: " << refitTime.count() / numIters
+              << " ms  Update: " << updateTime.count() / numIters
+              << " ms  Traversal: " << traversalTime.count() / numIters
+              << " ms  Collision detection: " << narrowTime.count() / numIters
+              << " ms" << std::endl;
+    std::cout << "Refitted nodes: " << 100.0f * refitNodes / totalNodes << "%"
+              << std::endl;
+    std::cout << "Candidate pairs per step: " << numPairs / numIters
+              << "  Collisions per step: " << numCollisions / numIters
+              << "  Throughput: "
+              << numPairs / (narrowTime.count() * 1000.0f) << " Mpairs/s"
+              << std::endl;
+    std::cout << "Contact cache: " << cacheTime.count() / numIters
+              << " ms  Full passes: " << contactCache.numFullPasses()
+              << "  Cached pairs: " << contactCache.numPairs()
+              << (cacheCollisions == numCollisions ? "  Same collisions"
+                                                   : "  Collisions differ")
+              << std::endl;
+
+    // Narrow phase over the same state with the batched and scalar kernels
+    Milliseconds kernelTimes[2];
+    uint64_t kernelCollisions[2];
+    for (uint32_t k = 0; k < 2; ++k)
+    {
+        anim::CollisionDetection::batchKernels = k == 0;
+        kernelTimes[k] = Milliseconds(0.0f);
+        kernelCollisions[k] = 0;
+        for (uint32_t iter = 0; iter < numIters; ++iter)
+        {
+            for (auto& nodes : nodesSet)
+            {
+                geometry::clearForce(nodes);
+                geometry::clearCollision(nodes);
+            }
+            startTime = std::chrono::steady_clock::now();
+            kernelCollisions[k] += anim::CollisionDetection::computeCollisions(
+                aabbs, 1.0f, 0.1f, &sweepAndPrune);
+            kernelTimes[k] += std::chrono::steady_clock::now() - startTime;
+        }
+    }
+    anim::CollisionDetection::batchKernels = true;
+    std::cout << "Batched kernel: " << kernelTimes[0].count() / numIters
+              << " ms  Scalar kernel: " << kernelTimes[1].count() / numIters
+              << " ms  Speedup: " << kernelTimes[1] / kernelTimes[0]
+              << (kernelCollisions[0] == kernelCollisions[1]
+                      ? "  Same collisions"
+                      : "  Collisions differ")
+              << std::endl;
+
+    // Same narrow phase with the forces summed in a reproducible order
+    Milliseconds deterministicTime(0.0f);
+    anim::CollisionDetection::deterministicContacts = true;
+    for (uint32_t iter = 0; iter < numIters; ++iter)
+    {
+        for (auto& nodes : nodesSet)
+        {
+            geometry::clearForce(nodes);
+            geometry::clearCollision(nodes);
+        }
+        startTime = std::chrono::steady_clock::now();
+        anim::CollisionDetection::computeCollisions(aabbs, 1.0f, 0.1f,
+                                                    &sweepAndPrune);
+        deterministicTime += std::chrono::steady_clock::now() - startTime;
+    }
+    anim::CollisionDetection::deterministicContacts = false;
+    std::cout << "Deterministic contacts: "
+              << deterministicTime.count() / numIters << " ms" << std::endl;
+
+    // Top level pairs and region queries with and without a scene tree
+    geometry::SceneHierarchicalAABB sceneAABB;
+    geometry::AxisAlignedBoundingBox region(geometry::Vec3(0.0f),
+                                            geometry::Vec3(sceneSize * 0.2f));
+    Milliseconds broadTimes[2];
+    Milliseconds regionTimes[2];
+    bool samePairs = true;
+    bool sameIds = true;
+    for (uint32_t k = 0; k < 2; ++k)
+    {
+        broadTimes[k] = Milliseconds(0.0f);
+        regionTimes[k] = Milliseconds(0.0f);
+        for (uint32_t iter = 0; iter < numIters; ++iter)
+        {
+            startTime = std::chrono::steady_clock::now();
+            auto pairs = k == 0 ? sweepAndPrune.collidingPairs(aabbs)
+                                : sceneAABB.collidingPairs(aabbs);
+            broadTimes[k] += std::chrono::steady_clock::now() - startTime;
+
+            startTime = std::chrono::steady_clock::now();
+            std::vector<uint32_t> ids;
+            if (k == 0)
+            {
+                for (uint32_t i = 0; i < aabbs.size(); ++i)
+                    if (region.isColliding(*aabbs[i])) ids.push_back(i);
+            }
+            else
+            {
+                ids = sceneAABB.collidingIds(region);
+            }
+            regionTimes[k] += std::chrono::steady_clock::now() - startTime;
+
+            if (k == 1)
+            {
+                auto sweepPairs = sweepAndPrune.collidingPairs(aabbs);
+                samePairs = samePairs && pairs == sweepPairs;
+                std::vector<uint32_t> linearIds;
+                for (uint32_t i = 0; i < aabbs.size(); ++i)
+                    if (region.isColliding(*aabbs[i])) linearIds.push_back(i);
+                sameIds = sameIds && ids == linearIds;
+            }
+        }
+    }
+    std::cout << "Scene BVH pairs: " << broadTimes[1].count() / numIters
+              << " ms  Sweep and prune: " << broadTimes[0].count() / numIters
+              << " ms" << (samePairs ? "  Same pairs" : "  Pairs differ")
+              << std::endl;
+    std::cout << "Scene BVH region query: "
+              << regionTimes[1].count() * 1000.0f / numIters
+              << " us  Linear: " << regionTimes[0].count() * 1000.0f / numIters
+              << " us" << (sameIds ? "  Same ids" : "  Ids differ")
+              << std::endl;
+
+    // Traversal over the same trees stored with quantized nodes
+    auto aabbPairs = sweepAndPrune.collidingPairs(aabbs);
+    uint64_t memory[2] = {0, 0};
+    uint64_t compressedPairs[2] = {0, 0};
+    Milliseconds compressedTimes[2];
+    for (uint32_t k = 0; k < 2; ++k)
+    {
+        if (k == 1)
+            for (auto aabb : aabbs) aabb->compress();
+        for (auto aabb : aabbs) memory[k] += aabb->nodesMemory();
+        startTime = std::chrono::steady_clock::now();
+        for (uint32_t iter = 0; iter < numIters; ++iter)
+            for (auto& aabbPair : aabbPairs)
+                aabbs[aabbPair.first]->collidingPrimitives(
+                    aabbs[aabbPair.second],
+                    [&](const geometry::PrimitivePair* pairs, uint32_t size) {
+                        compressedPairs[k] += size;
+                    });
+        compressedTimes[k] = std::chrono::steady_clock::now() - startTime;
+    }
+    std::cout << "Compressed nodes: " << memory[1] / 1024 << " KB of "
+              << memory[0] / 1024
+              << " KB  Traversal: " << compressedTimes[1].count() / numIters
+              << " ms of " << compressedTimes[0].count() / numIters << " ms"
+              << (compressedPairs[0] == compressedPairs[1] ? "  Same pairs"
+                                                           : "  Pairs differ")
+              << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,783 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <phyanim/Phyanim.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+
+using namespace phyanim;
+
+// Small scenes checked against the reference paths of the library. Exits
+// with an error code if any alternative path disagrees
+
+typedef std::set<geometry::PrimitivePair> PairSet;
+
+bool report(const std::string& name, bool passed, const std::string& details)
+{
+    std::cout << (passed ? "OK      " : "FAILED  ") << name << "  " << details
+              << std::endl;
+    return passed;
+}
+
+std::string number(float value)
+{
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+
+void generateChains(uint32_t numChains,
+                    uint32_t numSegments,
+                    float sceneSize,
+                    uint32_t seed,
+                    std::vector<geometry::Edges>& edgesSet,
+                    std::vector<geometry::Nodes>& nodesSet)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> position(0.0f, sceneSize);
+    std::uniform_real_distribution<float> step(-0.15f, 0.15f);
+
+    edgesSet.assign(numChains, geometry::Edges());
+    nodesSet.assign(numChains, geometry::Nodes());
+    for (uint32_t i = 0; i < numChains; ++i)
+    {
+        geometry::Vec3 pos(position(generator), position(generator),
+                           position(generator));
+        geometry::Vec3 dir(step(generator), step(generator), step(generator));
+        auto node = new geometry::Node(pos, 0, 0.1f);
+        nodesSet[i].push_back(node);
+        for (uint32_t j = 0; j < numSegments; ++j)
+        {
+            dir = dir * 0.8f +
+                  geometry::Vec3(step(generator), step(generator),
+                                 step(generator));
+            auto next = new geometry::Node(node->position + dir, j + 1, 0.1f);
+            nodesSet[i].push_back(next);
+            edgesSet[i].push_back(new geometry::Edge(node, next));
+            node = next;
+        }
+    }
+}
+
+// Unconnected triangles of random size and orientation
+void generateTriangles(uint32_t numSets,
+                       uint32_t numTriangles,
+                       float sceneSize,
+                       std::vector<geometry::Primitives>& trianglesSet,
+                       std::vector<geometry::Nodes>& nodesSet)
+{
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<float> position(0.0f, sceneSize);
+    std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+
+    trianglesSet.assign(numSets, geometry::Primitives());
+    nodesSet.assign(numSets, geometry::Nodes());
+    for (uint32_t i = 0; i < numSets; ++i)
+    {
+        for (uint32_t j = 0; j < numTriangles; ++j)
+        {
+            geometry::Vec3 center(position(generator), position(generator),
+                                  position(generator));
+            geometry::NodePtr nodes[3];
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                geometry::Vec3 pos(offset(generator), offset(generator),
+                                   offset(generator));
+                nodes[k] = new geometry::Node(center + pos, j * 3 + k, 0.0f);
+                nodesSet[i].push_back(nodes[k]);
+            }
+            trianglesSet[i].push_back(
+                new geometry::Triangle(nodes[0], nodes[1], nodes[2]));
+        }
+    }
+}
+
+std::vector<geometry::Vec3> forces(
+    const std::vector<geometry::Nodes>& nodesSet)
+{
+    std::vector<geometry::Vec3> result;
+    for (auto& nodes : nodesSet)
+        for (auto node : nodes) result.push_back(node->force);
+    return result;
+}
+
+float maxDifference(const std::vector<geometry::Vec3>& values0,
+                    const std::vector<geometry::Vec3>& values1)
+{
+    float difference = 0.0f;
+    for (uint32_t i = 0; i < values0.size(); ++i)
+        difference = std::max(difference,
+                              glm::distance(values0[i], values1[i]));
+    return difference;
+}
+
+void clearNodes(std::vector<geometry::Nodes>& nodesSet)
+{
+    for (auto& nodes : nodesSet)
+    {
+        geometry::clearForce(nodes);
+        geometry::clearCollision(nodes);
+    }
+}
+
+// Collisions and forces of the batched kernels against the scalar tests
+bool checkKernels()
+{
+    bool passed = true;
+    for (uint32_t k = 0; k < 2; ++k)
+    {
+        std::vector<geometry::Edges> edgesSet;
+        std::vector<geometry::Primitives> trianglesSet;
+        std::vector<geometry::Nodes> nodesSet;
+        geometry::HierarchicalAABBs aabbs;
+        if (k == 0)
+        {
+            generateChains(20, 200, 6.0f, 0, edgesSet, nodesSet);
+            for (auto& edges : edgesSet)
+                aabbs.push_back(new geometry::HierarchicalAABB(edges));
+        }
+        else
+        {
+            generateTriangles(4, 500, 6.0f, trianglesSet, nodesSet);
+            for (auto& triangles : trianglesSet)
+                aabbs.push_back(new geometry::HierarchicalAABB(triangles));
+        }
+
+        uint32_t collisions[2];
+        std::vector<geometry::Vec3> results[2];
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            anim::CollisionDetection::batchKernels = i == 0;
+            clearNodes(nodesSet);
+            collisions[i] =
+                anim::CollisionDetection::computeCollisions(aabbs, 1.0f, 0.1f);
+            results[i] = forces(nodesSet);
+        }
+        anim::CollisionDetection::batchKernels = true;
+
+        float difference = maxDifference(results[0], results[1]);
+        passed &= report(k == 0 ? "Edge kernel" : "Triangle kernel",
+                         collisions[0] == collisions[1] && collisions[0] > 0 &&
+                             difference < 1e-3f,
+                         "collisions " + std::to_string(collisions[0]) + " " +
+                             std::to_string(collisions[1]) +
+                             " force difference " +
+                             number(difference));
+        for (auto aabb : aabbs) delete aabb;
+    }
+    return passed;
+}
+
+// Pairs of every broad phase against testing all the pairs of limits, over
+// a few steps that move some of the hierarchies
+bool checkBroadPhases()
+{
+    std::vector<geometry::Edges> edgesSet;
+    std::vector<geometry::Nodes> nodesSet;
+    generateChains(200, 20, 30.0f, 1, edgesSet, nodesSet);
+    geometry::HierarchicalAABBs aabbs;
+    for (auto& edges : edgesSet)
+        aabbs.push_back(new geometry::HierarchicalAABB(edges));
+
+    std::vector<std::string> names = {"SweepAndPrune",
+                                      "IncrementalSweepAndPrune",
+                                      "UniformGrid", "SceneHierarchicalAABB"};
+    std::vector<geometry::BroadPhasePtr> broadPhases = {
+        new geometry::SweepAndPrune(),
+        new geometry::IncrementalSweepAndPrune(), new geometry::UniformGrid(),
+        new geometry::SceneHierarchicalAABB()};
+    auto sceneAABB =
+        static_cast<geometry::SceneHierarchicalAABB*>(broadPhases.back());
+    std::vector<bool> samePairs(broadPhases.size(), true);
+    bool sameIds = true;
+    uint64_t numPairs = 0;
+
+    std::mt19937 generator(2);
+    std::uniform_real_distribution<float> displacement(-2.0f, 2.0f);
+    geometry::AxisAlignedBoundingBox region(geometry::Vec3(5.0f),
+                                            geometry::Vec3(15.0f));
+    for (uint32_t step = 0; step < 5; ++step)
+    {
+        geometry::IndexPairs reference;
+        for (uint32_t i = 0; i < aabbs.size(); ++i)
+            for (uint32_t j = i + 1; j < aabbs.size(); ++j)
+                if (aabbs[i]->isColliding(*aabbs[j]))
+                    reference.push_back(std::make_pair(i, j));
+        numPairs += reference.size();
+
+        for (uint32_t i = 0; i < broadPhases.size(); ++i)
+        {
+            auto pairs = broadPhases[i]->collidingPairs(aabbs);
+            for (auto& pair : pairs)
+                if (pair.first > pair.second)
+                    std::swap(pair.first, pair.second);
+            std::sort(pairs.begin(), pairs.end());
+            samePairs[i] = samePairs[i] && pairs == reference;
+        }
+
+        std::vector<uint32_t> ids;
+        for (uint32_t i = 0; i < aabbs.size(); ++i)
+            if (region.isColliding(*aabbs[i])) ids.push_back(i);
+        sameIds = sameIds && sceneAABB->collidingIds(region) == ids;
+
+        // Moves every third chain
+        for (uint32_t i = step % 3; i < aabbs.size(); i += 3)
+        {
+            geometry::Vec3 offset(displacement(generator),
+                                  displacement(generator),
+                                  displacement(generator));
+            for (auto node : nodesSet[i])
+            {
+                node->position += offset;
+                node->dirty = true;
+            }
+            aabbs[i]->refit();
+            geometry::clearDirty(nodesSet[i]);
+        }
+    }
+
+    bool passed = true;
+    for (uint32_t i = 0; i < broadPhases.size(); ++i)
+    {
+        passed &= report(names[i], samePairs[i],
+                         std::to_string(numPairs) + " pairs in 5 steps");
+        delete broadPhases[i];
+    }
+    passed &= report("SceneHierarchicalAABB ids", sameIds, "5 region queries");
+    for (auto aabb : aabbs) delete aabb;
+    return passed;
+}
+
+// Stored pairs of two trees filtered by the limits of their primitives, as
+// the streamed traversals do
+PairSet limitPairs(geometry::HierarchicalAABBPtr aabb0,
+                   geometry::HierarchicalAABBPtr aabb1)
+{
+    PairSet pairs;
+    for (auto& pair : aabb0->collidingPrimitives(aabb1))
+        if (pair.first->areLimitsColliding(pair.second)) pairs.insert(pair);
+    return pairs;
+}
+
+// Streamed, split, self, compressed and fattened traversals against the
+// pairs of the plain traversal from the roots
+bool checkTraversals()
+{
+    // Two trees over interleaved bundles of chains
+    std::vector<geometry::Edges> edgesSet;
+    std::vector<geometry::Nodes> nodesSet;
+    generateChains(40, 400, 2.0f, 4, edgesSet, nodesSet);
+    geometry::Edges edges0, edges1;
+    for (uint32_t i = 0; i < edgesSet.size(); ++i)
+    {
+        auto& edges = i % 2 == 0 ? edges0 : edges1;
+        edges.insert(edges.end(), edgesSet[i].begin(), edgesSet[i].end());
+    }
+    auto aabb0 = new geometry::HierarchicalAABB(edges0, 4);
+    auto aabb1 = new geometry::HierarchicalAABB(edges1, 4);
+    auto collect = [](PairSet& pairs, uint64_t& count) {
+        return [&pairs, &count](const geometry::PrimitivePair* batch,
+                                uint32_t size) {
+            pairs.insert(batch, batch + size);
+            count += size;
+        };
+    };
+
+    PairSet reference = limitPairs(aabb0, aabb1);
+
+    PairSet streamed, split, compressed, fattened, self, selfSplit;
+    uint64_t numStreamed = 0, numSplit = 0, numCompressed = 0;
+    uint64_t numFattened = 0, numSelf = 0, numSelfSplit = 0;
+    aabb0->collidingPrimitives(aabb1, collect(streamed, numStreamed));
+    auto nodePairs = aabb0->collidingNodes(aabb1, 6);
+    for (auto& pair : nodePairs)
+        aabb0->collidingPrimitives(aabb1, pair.first, pair.second,
+                                   collect(split, numSplit));
+    aabb0->selfCollidingPrimitives(collect(self, numSelf));
+    auto selfPairs = aabb0->selfCollidingNodes(6);
+    for (auto& pair : selfPairs)
+        aabb0->selfCollidingPrimitives(pair.first, pair.second,
+                                       collect(selfSplit, numSelfSplit));
+
+    // Split pairs of the plain trees streamed over the compressed ones
+    bool compressedOk = aabb0->compress() && aabb1->compress();
+    for (auto& pair : nodePairs)
+        aabb0->collidingPrimitives(aabb1, pair.first, pair.second,
+                                   collect(compressed, numCompressed));
+    aabb0->decompress();
+    aabb1->decompress();
+
+    // A margin only adds pairs
+    aabb0->collidingPrimitives(aabb1, collect(fattened, numFattened), 0.05f);
+    bool fattenedOk = std::includes(fattened.begin(), fattened.end(),
+                                    reference.begin(), reference.end());
+
+    bool passed = true;
+    std::string pairs = std::to_string(reference.size()) + " pairs";
+    passed &= report("Streamed traversal",
+                     reference.size() >= 1000 && streamed == reference &&
+                         numStreamed == reference.size(),
+                     pairs);
+    passed &= report("Split traversal",
+                     nodePairs.size() > 1 && split == reference &&
+                         numSplit == reference.size(),
+                     pairs + " from " + std::to_string(nodePairs.size()) +
+                         " node pairs");
+    passed &= report("Compressed traversal",
+                     compressedOk && compressed == reference &&
+                         numCompressed == reference.size(),
+                     pairs);
+    passed &= report("Fattened traversal",
+                     fattenedOk && numFattened == fattened.size(),
+                     std::to_string(fattened.size()) + " pairs");
+    passed &= report("Split self traversal",
+                     selfSplit == self && numSelfSplit == numSelf &&
+                         numSelf == self.size(),
+                     std::to_string(self.size()) + " pairs");
+    delete aabb0;
+    delete aabb1;
+    return passed;
+}
+
+// Pairs of a tree rebuilt when its SAH cost degrades, in place and in the
+// background, against a tree built from scratch after every step
+bool checkRebuilds()
+{
+    bool passed = true;
+    for (uint32_t k = 0; k < 2; ++k)
+    {
+        std::vector<geometry::Edges> edgesSet;
+        std::vector<geometry::Nodes> nodesSet;
+        generateChains(2, 2000, 0.0f, 7, edgesSet, nodesSet);
+        auto aabb0 =
+            new geometry::HierarchicalAABB(edgesSet[0], 10, geometry::SAH);
+        auto aabb1 = new geometry::HierarchicalAABB(edgesSet[1]);
+        auto refitted =
+            new geometry::HierarchicalAABB(edgesSet[0], 10, geometry::SAH);
+        aabb0->rebuildThreshold = 1.5f;
+        aabb0->asyncRebuild = k == 1;
+
+        // Nodes wander apart, so refitting alone degrades the tree
+        std::mt19937 generator(8);
+        std::uniform_real_distribution<float> displacement(-0.5f, 0.5f);
+        bool samePairs = true;
+        uint64_t numPairs = 0;
+        for (uint32_t step = 0; step < 5; ++step)
+        {
+            for (auto node : nodesSet[0])
+            {
+                node->position += geometry::Vec3(displacement(generator),
+                                                 displacement(generator),
+                                                 displacement(generator));
+                node->dirty = true;
+            }
+            aabb0->refit();
+            refitted->refit();
+            geometry::clearDirty(nodesSet[0]);
+
+            geometry::HierarchicalAABB built(edgesSet[0]);
+            auto reference = limitPairs(&built, aabb1);
+            samePairs = samePairs && limitPairs(aabb0, aabb1) == reference;
+            numPairs += reference.size();
+        }
+
+        // A background build is swapped in by a later refit
+        for (uint32_t i = 0; i < 1000 && aabb0->sahCostRatio() >= 1.5f; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            aabb0->refit();
+        }
+        geometry::HierarchicalAABB built(edgesSet[0]);
+        samePairs = samePairs &&
+                    limitPairs(aabb0, aabb1) == limitPairs(&built, aabb1);
+
+        passed &= report(k == 0 ? "SAH rebuild" : "Async SAH rebuild",
+                         samePairs && numPairs > 0 &&
+                             aabb0->sahCostRatio() < 1.5f &&
+                             refitted->sahCostRatio() >= 1.5f,
+                         std::to_string(numPairs) +
+                             " pairs in 5 steps, cost ratio " +
+                             number(aabb0->sahCostRatio()) +
+                             " refitting only " +
+                             number(refitted->sahCostRatio()));
+        delete aabb0;
+        delete aabb1;
+        delete refitted;
+    }
+    return passed;
+}
+
+// Deterministic contacts and the contact cache against the direct detection
+bool checkContacts()
+{
+    std::vector<geometry::Edges> edgesSet;
+    std::vector<geometry::Nodes> nodesSet;
+    generateChains(20, 200, 6.0f, 5, edgesSet, nodesSet);
+    geometry::HierarchicalAABBs aabbs;
+    for (auto& edges : edgesSet)
+        aabbs.push_back(new geometry::HierarchicalAABB(edges));
+
+    clearNodes(nodesSet);
+    uint32_t collisions =
+        anim::CollisionDetection::computeCollisions(aabbs, 1.0f, 0.1f);
+    auto reference = forces(nodesSet);
+
+    anim::CollisionDetection::deterministicContacts = true;
+    clearNodes(nodesSet);
+    uint32_t deterministicCollisions =
+        anim::CollisionDetection::computeCollisions(aabbs, 1.0f, 0.1f);
+    anim::CollisionDetection::deterministicContacts = false;
+    float deterministicDifference = maxDifference(reference, forces(nodesSet));
+
+    // Small motions keep the cached pairs valid between full passes
+    anim::ContactCache cache(0.2f, 5);
+    std::mt19937 generator(6);
+    std::uniform_real_distribution<float> displacement(-0.02f, 0.02f);
+    bool sameCached = true;
+    for (uint32_t step = 0; step < 8; ++step)
+    {
+        clearNodes(nodesSet);
+        uint32_t direct =
+            anim::CollisionDetection::computeCollisions(aabbs, 1.0f, 0.1f);
+        auto directForces = forces(nodesSet);
+        clearNodes(nodesSet);
+        uint32_t cached = cache.computeCollisions(aabbs, 1.0f, 0.1f);
+        sameCached = sameCached && cached == direct &&
+                     maxDifference(directForces, forces(nodesSet)) < 1e-4f;
+
+        for (uint32_t i = 0; i < nodesSet.size(); ++i)
+        {
+            for (auto node : nodesSet[i])
+            {
+                node->position +=
+                    geometry::Vec3(displacement(generator),
+                                   displacement(generator),
+                                   displacement(generator));
+                node->dirty = true;
+            }
+            aabbs[i]->refit();
+            geometry::clearDirty(nodesSet[i]);
+        }
+    }
+
+    bool passed = true;
+    passed &= report("Deterministic contacts",
+                     deterministicCollisions == collisions &&
+                         deterministicDifference < 1e-4f,
+                     "collisions " + std::to_string(collisions) +
+                         " force difference " +
+                         number(deterministicDifference));
+    passed &= report("Contact cache", sameCached,
+                     "8 steps, " + std::to_string(cache.numFullPasses()) +
+                         " full passes");
+    for (auto aabb : aabbs) delete aabb;
+    return passed;
+}
+
+// A capsule going through another one within a step is moved back before
+// the impact, and the displacement of the nodes is bounded by their radius
+bool checkContinuous()
+{
+    auto a0 = new geometry::Node(geometry::Vec3(-1.0f, 0.0f, 0.0f), 0, 0.1f);
+    auto a1 = new geometry::Node(geometry::Vec3(1.0f, 0.0f, 0.0f), 1, 0.1f);
+    auto b0 = new geometry::Node(geometry::Vec3(0.0f, 1.0f, -1.0f), 0, 0.1f);
+    auto b1 = new geometry::Node(geometry::Vec3(0.0f, 1.0f, 1.0f), 1, 0.1f);
+    geometry::Edges edges0 = {new geometry::Edge(a0, a1)};
+    geometry::Edges edges1 = {new geometry::Edge(b0, b1)};
+    geometry::HierarchicalAABBs aabbs = {
+        new geometry::HierarchicalAABB(edges0),
+        new geometry::HierarchicalAABB(edges1)};
+
+    geometry::Nodes nodes = {b0, b1};
+    for (auto node : nodes)
+    {
+        node->position.y = -1.0f;
+        node->dirty = true;
+    }
+    for (auto aabb : aabbs)
+    {
+        aabb->swept = true;
+        aabb->refit();
+    }
+    geometry::clearDirty(nodes);
+    uint32_t impacts =
+        anim::CollisionDetection::computeContinuousCollisions(aabbs, 0.01f);
+    float gap = std::min(b0->position.y, b1->position.y);
+
+    // Steps of random length along random directions
+    std::vector<geometry::Edges> edgesSet;
+    std::vector<geometry::Nodes> nodesSet;
+    generateChains(1, 200, 0.0f, 9, edgesSet, nodesSet);
+    std::mt19937 generator(10);
+    std::uniform_real_distribution<float> displacement(-0.5f, 0.5f);
+    std::vector<geometry::Vec3> directions;
+    for (auto node : nodesSet[0])
+    {
+        geometry::Vec3 direction(displacement(generator),
+                                 displacement(generator),
+                                 displacement(generator));
+        node->prevPosition = node->position;
+        node->position += direction;
+        directions.push_back(direction);
+    }
+    geometry::limitDisplacement(nodesSet[0]);
+    bool bounded = true;
+    for (uint32_t i = 0; i < nodesSet[0].size(); ++i)
+    {
+        auto node = nodesSet[0][i];
+        auto step = node->position - node->prevPosition;
+        float length = glm::length(step);
+        bounded = bounded && length <= node->radius * 1.001f &&
+                  glm::dot(step, directions[i]) >=
+                      0.999f * length * glm::length(directions[i]);
+    }
+
+    bool passed = true;
+    passed &= report("Continuous collisions",
+                     impacts == 1 && gap > 0.1f && gap < 1.0f,
+                     "impacts " + std::to_string(impacts) + " stopped at " +
+                         number(gap));
+    passed &= report("Limited displacement", bounded,
+                     std::to_string(nodesSet[0].size()) + " nodes");
+    for (auto aabb : aabbs) delete aabb;
+    return passed;
+}
+
+geometry::MeshPtr generateTetMesh(uint32_t size)
+{
+    auto mesh = new geometry::Mesh(1000.0f, 1.0f, 1.0f, 0.3f);
+    for (uint32_t z = 0; z < size; ++z)
+        for (uint32_t y = 0; y < size; ++y)
+            for (uint32_t x = 0; x < size; ++x)
+            {
+                auto node = new geometry::Node(geometry::Vec3(x, y, z),
+                                               mesh->nodes.size());
+                node->mass = 1.0f + 0.1f * x;
+                node->fix = y == 0;
+                mesh->nodes.push_back(node);
+            }
+
+    auto id = [&](uint32_t x, uint32_t y, uint32_t z) {
+        return mesh->nodes[x + size * (y + size * z)];
+    };
+    for (uint32_t z = 0; z + 1 < size; ++z)
+        for (uint32_t y = 0; y + 1 < size; ++y)
+            for (uint32_t x = 0; x + 1 < size; ++x)
+            {
+                // Five tetrahedra per cube
+                geometry::NodePtr a = id(x, y, z), b = id(x + 1, y, z),
+                                  c = id(x, y + 1, z), d = id(x, y, z + 1),
+                                  e = id(x + 1, y + 1, z),
+                                  f = id(x + 1, y, z + 1),
+                                  g = id(x, y + 1, z + 1),
+                                  h = id(x + 1, y + 1, z + 1);
+                geometry::NodePtr tets[5][4] = {{a, b, c, d},
+                                                {b, e, c, h},
+                                                {b, f, d, h},
+                                                {c, g, d, h},
+                                                {b, c, d, h}};
+                for (auto& tet : tets)
+                    mesh->tetrahedra.push_back(new geometry::Tetrahedron(
+                        tet[0], tet[1], tet[2], tet[3]));
+            }
+    return mesh;
+}
+
+// Ownership of the objects created in an arena through resample, swap,
+// clear and mesh copies
+bool checkArenas()
+{
+    geometry::Arena arena;
+    geometry::Nodes nodes;
+    geometry::Edges edges;
+    for (uint32_t i = 0; i < 10; ++i)
+        nodes.push_back(arena.create<geometry::Node>(
+            geometry::Vec3(i, 0.0f, 0.0f), i, 0.1f));
+    for (uint32_t i = 1; i < nodes.size(); ++i)
+        edges.push_back(arena.create<geometry::Edge>(nodes[i - 1], nodes[i]));
+    auto node = new geometry::Node(geometry::Vec3(), 0, 0.1f);
+    bool owned = arena.owns(nodes[0]) && arena.owns(edges[0]) &&
+                 !arena.owns(node);
+    delete node;
+
+    // Each unit edge becomes four connected ones
+    geometry::resample(edges, 0.25f, arena);
+    bool resampled = edges.size() == 36;
+    float length = 0.0f;
+    for (uint32_t i = 0; i < edges.size(); ++i)
+    {
+        resampled = resampled && arena.owns(edges[i]) &&
+                    arena.owns(edges[i]->node0) &&
+                    (i == 0 || edges[i]->node0 == edges[i - 1]->node1);
+        length += glm::distance(edges[i]->node0->position,
+                                edges[i]->node1->position);
+    }
+    resampled = resampled && std::abs(length - 9.0f) < 1e-4f;
+
+    geometry::Arena other;
+    other.swap(arena);
+    bool swapped = other.owns(edges[0]) && !arena.owns(edges[0]) &&
+                   arena.usedBytes() == 0 && other.usedBytes() > 0;
+    // Cleared memory is reused from the start of the first chunk
+    other.clear();
+    bool cleared = other.usedBytes() == 0 &&
+                   other.create<geometry::Node>(geometry::Vec3(), 0) ==
+                       nodes[0];
+
+    // Copies live in their own arena and outlive the original mesh
+    auto mesh = generateTetMesh(3);
+    auto copy = mesh->copy(false, false, true, false);
+    bool copied = copy->nodes.size() == mesh->nodes.size() &&
+                  copy->tetrahedra.size() == mesh->tetrahedra.size() &&
+                  !mesh->arena.owns(mesh->nodes[0]);
+    for (auto tet : copy->tetrahedra)
+        copied = copied && copy->arena.owns(tet);
+    delete mesh;
+    for (uint32_t i = 0; i < copy->nodes.size(); ++i)
+        copied = copied && copy->arena.owns(copy->nodes[i]) &&
+                 copy->nodes[i]->position == copy->nodes[i]->initPosition;
+    copy->clearData();
+    copied = copied && copy->nodes.empty() && copy->arena.usedBytes() == 0;
+    delete copy;
+
+    bool passed = true;
+    passed &= report("Arena ownership", owned && swapped && cleared,
+                     "create, swap and clear");
+    passed &= report("Arena resample", resampled,
+                     std::to_string(edges.size()) + " edges, length " +
+                         number(length));
+    passed &= report("Arena mesh copy", copied, "27 nodes");
+    return passed;
+}
+
+// Positions after a few implicit steps with every backend against the LDLT
+// factorization
+bool checkFEMBackends()
+{
+    std::vector<std::string> names = {"CG", "ICCG", "LDLT", "Auto",
+                                      "Matrix free", "Block CG"};
+    std::vector<geometry::SolverType> types = {
+        geometry::CG_SOLVER,          geometry::ICCG_SOLVER,
+        geometry::LDLT_SOLVER,        geometry::AUTO_SOLVER,
+        geometry::MATRIX_FREE_SOLVER, geometry::BLOCK_CG_SOLVER};
+    std::vector<std::vector<geometry::Vec3>> positions(types.size());
+    for (uint32_t i = 0; i < types.size(); ++i)
+    {
+        auto mesh = generateTetMesh(6);
+        anim::ImplicitFEMSystem system(0.01f);
+        system.gravity = false;
+        system.solverType = types[i];
+        system.tolerance = 1e-6f;
+        system.preprocessMesh(mesh);
+        for (uint32_t step = 0; step < 10; ++step)
+        {
+            for (auto node : mesh->nodes)
+                node->force = geometry::Vec3(0.0f, 0.0f, 0.5f);
+            system.step(mesh);
+        }
+        for (auto node : mesh->nodes)
+            positions[i].push_back(node->position - node->initPosition);
+        delete mesh;
+    }
+
+    // Displacements compared relative to the largest one
+    auto& reference = positions[2];
+    std::vector<geometry::Vec3> rest(reference.size(), geometry::Vec3());
+    float scale = maxDifference(reference, rest);
+    bool passed = scale > 0.0f;
+    for (uint32_t i = 0; i < types.size(); ++i)
+    {
+        if (i == 2) continue;
+        float difference = maxDifference(reference, positions[i]) / scale;
+        passed &= report(names[i] + " backend", difference < 1e-3f,
+                         "relative difference " + number(difference));
+    }
+    return passed;
+}
+
+// Meshes preprocessed with CG, then updated with a new stiffness and every
+// backend, against a mesh preprocessed with the new stiffness and LDLT
+bool checkUpdateMesh()
+{
+    std::vector<std::string> names = {"CG", "ICCG", "LDLT", "Auto",
+                                      "Matrix free", "Block CG"};
+    std::vector<geometry::SolverType> types = {
+        geometry::CG_SOLVER,          geometry::ICCG_SOLVER,
+        geometry::LDLT_SOLVER,        geometry::AUTO_SOLVER,
+        geometry::MATRIX_FREE_SOLVER, geometry::BLOCK_CG_SOLVER};
+    auto displacements = [](geometry::SolverType type, bool update) {
+        auto mesh = generateTetMesh(5);
+        anim::ImplicitFEMSystem system(0.01f);
+        system.gravity = false;
+        system.tolerance = 1e-6f;
+        system.solverType = update ? geometry::CG_SOLVER : type;
+        if (!update) mesh->stiffness = 2000.0f;
+        system.preprocessMesh(mesh);
+        if (update)
+        {
+            mesh->stiffness = 2000.0f;
+            system.solverType = type;
+            system.updateMesh(mesh);
+        }
+        for (uint32_t step = 0; step < 10; ++step)
+        {
+            for (auto node : mesh->nodes)
+                node->force = geometry::Vec3(0.0f, 0.0f, 0.5f);
+            system.step(mesh);
+        }
+        std::vector<geometry::Vec3> result;
+        for (auto node : mesh->nodes)
+            result.push_back(node->position - node->initPosition);
+        delete mesh;
+        return result;
+    };
+
+    auto reference = displacements(geometry::LDLT_SOLVER, false);
+    std::vector<geometry::Vec3> rest(reference.size(), geometry::Vec3());
+    float scale = maxDifference(reference, rest);
+    bool passed = scale > 0.0f;
+    for (uint32_t i = 0; i < types.size(); ++i)
+    {
+        float difference =
+            maxDifference(reference, displacements(types[i], true)) / scale;
+        passed &= report(names[i] + " update", difference < 1e-3f,
+                         "relative difference " + number(difference));
+    }
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    bool passed = checkKernels();
+    passed &= checkBroadPhases();
+    passed &= checkTraversals();
+    passed &= checkRebuilds();
+    passed &= checkContacts();
+    passed &= checkContinuous();
+    passed &= checkArenas();
+    passed &= checkFEMBackends();
+    passed &= checkUpdateMesh();
+
+    std::cout << (passed ? "All checks passed" : "Some checks failed")
+              << std::endl;
+    return passed ? 0 : 1;
+}
@@ -36,6 +36,14 @@ int main(int argc, char* argv[])
 
     float threshold = 1.0f;
     float dt = 0.0001f;
+    phyanim::geometry::BroadPhasePtr broadPhase = nullptr;
+    uint64_t leafSize = 10;
+    phyanim::geometry::SplitMethod splitMethod = phyanim::geometry::MIDPOINT;
+    float rebuildThreshold = 0.0f;
+    bool asyncRebuild = false;
+    bool continuous = false;
+    bool cacheContacts = false;
+    float margin = 0.0f;
 
     for (uint32_t i = 1; i < argc; ++i)
     {
@@ -73,6 +81,47 @@ int main(int argc, char* argv[])
             ++i;
             threshold = std::atof(argv[i]);
         }
+        else if (arg.compare("-grid") == 0)
+            broadPhase = new phyanim::geometry::UniformGrid();
+        else if (arg.compare("-tlas") == 0)
+            broadPhase = new phyanim::geometry::SceneHierarchicalAABB();
+        else if (arg.compare("-leaf") == 0)
+        {
+            ++i;
+            leafSize = std::stoul(argv[i]);
+        }
+        else if (arg.compare("-rebuild") == 0)
+        {
+            ++i;
+            rebuildThreshold = std::atof(argv[i]);
+        }
+        else if (arg.compare("-async") == 0)
+            asyncRebuild = true;
+        else if (arg.compare("-ccd") == 0)
+            continuous = true;
+        else if (arg.compare("-cache") == 0)
+            cacheContacts = true;
+        else if (arg.compare("-margin") == 0)
+        {
+            ++i;
+            margin = std::atof(argv[i]);
+        }
+        else if (arg.compare("-dt") == 0)
+        {
+            ++i;
+            dt = std::atof(argv[i]);
+        }
+        else if (arg.compare("-split") == 0)
+        {
+            ++i;
+            std::string method(argv[i]);
+            if (method.compare("median") == 0)
+                splitMethod = phyanim::geometry::MEDIAN;
+            else if (method.compare("sah") == 0)
+                splitMethod = phyanim::geometry::SAH;
+            else
+                splitMethod = phyanim::geometry::MIDPOINT;
+        }
         else if (arg.find(".json") != std::string::npos)
             circuitPath = arg;
         else
@@ -80,7 +129,9 @@ int main(int argc, char* argv[])
 
         // std::cerr << "Unknown file format: " << _args[i] << std::endl;
     }
-    auto solver = new examples::CollisionSolver(dt);
+    auto solver = new examples::CollisionSolver(dt, broadPhase);
+    solver->continuous = continuous;
+    solver->cacheContacts = cacheContacts;
 
     examples::Circuit circuit(circuitPath, pop);
     std::cout << "Number of morphologies to load: " << ids.size() << std::endl;
@@ -101,10 +152,16 @@ int main(int argc, char* argv[])
     for (uint32_t i = 0; i < size; ++i)
     {
         edgesSet[i] = morphologies[i]->edges;
-        phyanim::geometry::resample(edgesSet[i], 0.15);
+        phyanim::geometry::resample(edgesSet[i], 0.15,
+                                    morphologies[i]->arena);
         phyanim::geometry::removeOutEdges(edgesSet[i], *limits);
         nodesSet[i] = phyanim::geometry::uniqueNodes(edgesSet[i]);
-        morphoAABBs[i] = new phyanim::geometry::HierarchicalAABB(edgesSet[i]);
+        morphoAABBs[i] = new phyanim::geometry::HierarchicalAABB(
+            edgesSet[i], leafSize, splitMethod);
+        morphoAABBs[i]->rebuildThreshold = rebuildThreshold;
+        morphoAABBs[i]->asyncRebuild = asyncRebuild;
+        morphoAABBs[i]->margin = margin;
+        if (margin > 0.0f) morphoAABBs[i]->update();
         // #ifdef PHYANIM_USES_OPENMP
         // #pragma omp critical
         // #endif
@@ -114,6 +171,34 @@ int main(int argc, char* argv[])
         //         }
     }
 
+    uint32_t numNodes = 0;
+    uint32_t numLeaves = 0;
+    uint32_t maxDepth = 0;
+    uint32_t maxLeafSize = 0;
+    float meanDepth = 0.0f;
+    float sahCost = 0.0f;
+    for (auto aabb : morphoAABBs)
+    {
+        auto stats = aabb->stats();
+        numNodes += stats.numNodes;
+        numLeaves += stats.numLeaves;
+        maxDepth = std::max(maxDepth, stats.maxDepth);
+        maxLeafSize = std::max(maxLeafSize, stats.maxLeafSize);
+        meanDepth += stats.meanDepth * stats.numLeaves;
+        sahCost += stats.sahCost;
+    }
+    if (numLeaves > 0)
+    {
+        uint32_t numPrimitives = 0;
+        for (auto& edges : edgesSet) numPrimitives += edges.size();
+        std::cout << "BVH nodes: " << numNodes << "  Leaves: " << numLeaves
+                  << "  Max depth: " << maxDepth
+                  << "  Mean depth: " << meanDepth / numLeaves
+                  << "  Max leaf size: " << maxLeafSize
+                  << "  Mean leaf size: " << (float)numPrimitives / numLeaves
+                  << "  Mean SAH cost: " << sahCost / size << std::endl;
+    }
+
     // std::cout << "Simulation with " << sizeEdges << " springs and " <<
     // sizeNodes
     //           << " nodes" << std::endl;
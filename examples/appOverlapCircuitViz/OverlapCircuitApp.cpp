@@ -134,7 +134,7 @@ void OverlapCircuitApp::_actionLoop()
     for (uint32_t i = 0; i < size; ++i)
     {
         edgesSet[i] = morphologies[i]->edges;
-        resample(edgesSet[i], 0.15);
+        resample(edgesSet[i], 0.15, morphologies[i]->arena);
         removeOutEdges(edgesSet[i], _limits);
         nodesSet[i] = uniqueNodes(edgesSet[i]);
         morphoAABBs[i] = new geometry::HierarchicalAABB(edgesSet[i]);
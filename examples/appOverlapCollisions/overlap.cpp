@@ -27,6 +27,8 @@ float dt = 0.01;
 float bbFactor = 1.5;
 float initCollisionStiffness = 2.0;
 float collisionStiffnessMultiplier = 0.1;
+float tolerance = 0.0;
+uint32_t maxIterations = 0;
 
 geometry::Meshes meshes;
 std::vector<geometry::HierarchicalAABBPtr> tetAABBs;
@@ -169,6 +171,9 @@ void resolveCollision(geometry::AxisAlignedBoundingBoxPtr aabb)
     animSys->preprocessMesh(slicedMeshes);
     float collisionStiffness = initCollisionStiffness;
 
+    uint64_t numSteps = 0;
+    uint64_t numIterations = 0;
+    float maxError = 0.0f;
     bool collision = true;
     while (collision)
     {
@@ -178,6 +183,12 @@ void resolveCollision(geometry::AxisAlignedBoundingBoxPtr aabb)
         if (collision)
         {
             animSys->step(slicedMeshes);
+            ++numSteps;
+            for (auto mesh : slicedMeshes)
+            {
+                numIterations += mesh->AMatrixSolverIterations;
+                maxError = std::max(maxError, mesh->AMatrixSolverError);
+            }
             for (auto mesh : slicedMeshes) mesh->boundingBox->update();
             collisionStiffness +=
                 initCollisionStiffness * collisionStiffnessMultiplier;
@@ -190,7 +201,9 @@ void resolveCollision(geometry::AxisAlignedBoundingBoxPtr aabb)
     {
         std::cout << "Collision with radius: " << aabb->radius()
                   << "\tsolved in: " << elapsedTime.count() << " seconds"
-                  << std::endl;
+                  << "\tsteps: " << numSteps << "\tmean solver iterations: "
+                  << (numSteps > 0 ? (float)numIterations / numSteps : 0.0f)
+                  << "\tmax solver error: " << maxError << std::endl;
     }
 }
 
@@ -248,11 +261,24 @@ int main(int argc, char* argv[])
             ++i;
             stiffness = std::atof(argv[i]);
         }
+        else if (option.compare("-tol") == 0)
+        {
+            ++i;
+            tolerance = std::atof(argv[i]);
+        }
+        else if (option.compare("-iters") == 0)
+        {
+            ++i;
+            maxIterations = std::stoul(argv[i]);
+        }
         else if (option.find(".tet") != std::string::npos)
             files.push_back(option);
     }
 
-    animSys = new anim::ImplicitFEMSystem(dt);
+    auto femSys = new anim::ImplicitFEMSystem(dt);
+    femSys->tolerance = tolerance;
+    femSys->maxIterations = maxIterations;
+    animSys = femSys;
     animSys->gravity = false;
     std::cout << std::fixed << std::setprecision(2);
     std::cout << "Overlap run with dt: " << dt << " stiffness: " << stiffness
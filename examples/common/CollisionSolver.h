@@ -31,14 +31,30 @@ namespace examples
 class CollisionSolver
 {
 public:
-    CollisionSolver(float dt) : _dt(dt)
+    CollisionSolver(float dt, geometry::BroadPhasePtr broadPhase = nullptr)
+        : continuous(false)
+        , cacheContacts(false)
+        , _dt(dt)
+        , _broadPhase(broadPhase)
+        , _continuousBroadPhase(new geometry::IncrementalSweepAndPrune())
+        , _collisionTime(0.0f)
+        , _stepTime(0.0f)
+        , _refitNodes(0)
+        , _totalNodes(0)
+        , _impacts(0)
     {
         _system = new anim::ExplicitMassSpringSystem(_dt);
         _system->gravity = false;
         _system->inertia = false;
+        if (!_broadPhase)
+            _broadPhase = new geometry::IncrementalSweepAndPrune();
     };
 
-    ~CollisionSolver(){};
+    ~CollisionSolver()
+    {
+        delete _broadPhase;
+        delete _continuousBroadPhase;
+    };
 
     uint32_t solveCollisions(geometry::HierarchicalAABBs& aabbs,
                              std::vector<geometry::Edges>& edgesSet,
@@ -47,6 +63,9 @@ public:
                              uint32_t& totalIters,
                              float threshold)
     {
+        // The cached pairs may belong to primitives of a previous call
+        _contactCache.clear();
+
         geometry::Edges edges;
         for (uint32_t i = 0; i < edgesSet.size(); ++i)
             edges.insert(edges.end(), edgesSet[i].begin(), edgesSet[i].end());
@@ -57,6 +76,11 @@ public:
 
         auto startTime = std::chrono::steady_clock::now();
         std::chrono::duration<float> elapsedTime;
+        _collisionTime = std::chrono::duration<float>::zero();
+        _stepTime = std::chrono::duration<float>::zero();
+        _refitNodes = 0;
+        _totalNodes = 0;
+        _impacts = 0;
         uint32_t collisions = 1;
         float ks = 1000.0f;
         float ksc = 100.0f;
@@ -93,6 +117,19 @@ public:
                   << "  Collisions: " << collisions << "  Stiffness: " << ks
                   << "  Time: " << elapsedTime.count() << " seconds."
                   << std::endl;
+        std::cout << "Collision detection time: " << _collisionTime.count()
+                  << " seconds.  Step and AABB update time: "
+                  << _stepTime.count() << " seconds." << std::endl;
+        if (_totalNodes > 0)
+            std::cout << "Refitted BVH nodes: "
+                      << 100.0f * _refitNodes / _totalNodes << "%"
+                      << std::endl;
+        if (continuous)
+            std::cout << "Continuous collision impacts: " << _impacts
+                      << std::endl;
+        if (cacheContacts)
+            std::cout << "Contact cache full passes: "
+                      << _contactCache.numFullPasses() << std::endl;
 
         return collisions;
     };
@@ -116,17 +153,56 @@ public:
             clearCollision(nodesSet[i]);
         }
 
+        auto startTime = std::chrono::steady_clock::now();
         uint32_t collisions =
-            anim::CollisionDetection::computeCollisions(aabbs, ksc, threshold);
+            cacheContacts
+                ? _contactCache.computeCollisions(aabbs, ksc, threshold)
+                : anim::CollisionDetection::computeCollisions(
+                      aabbs, ksc, threshold, _broadPhase);
+        auto collisionTime = std::chrono::steady_clock::now();
+        _collisionTime += collisionTime - startTime;
         if (collisions == 0) return 0;
+        uint64_t refitNodes = 0;
+        uint64_t totalNodes = 0;
 #ifdef PHYANIM_USES_OPENMP
-#pragma omp parallel for
+#pragma omp parallel for reduction(+ : refitNodes, totalNodes)
 #endif
         for (uint32_t i = 0; i < size; ++i)
         {
             _system->step(nodesSet[i], edgesSet[i], limits, ks, kd);
-            aabbs[i]->update();
+            if (continuous) geometry::limitDisplacement(nodesSet[i]);
+            aabbs[i]->swept = continuous;
+            refitNodes += aabbs[i]->refit();
+            totalNodes += aabbs[i]->numNodes();
+            geometry::clearDirty(nodesSet[i]);
         }
+
+        // Nodes that would still tunnel through others during the step are
+        // moved back to the impact, only their primitives are refitted again.
+        // The pass keeps its own broad phase, the swept limits would break
+        // the coherence of the discrete one.
+        if (continuous)
+        {
+            uint64_t impacts =
+                anim::CollisionDetection::computeContinuousCollisions(
+                    aabbs, 0.01f, _continuousBroadPhase);
+            _impacts += impacts;
+            if (impacts > 0)
+            {
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for reduction(+ : refitNodes)
+#endif
+                for (uint32_t i = 0; i < size; ++i)
+                {
+                    aabbs[i]->swept = false;
+                    refitNodes += aabbs[i]->refit();
+                    geometry::clearDirty(nodesSet[i]);
+                }
+            }
+        }
+        _refitNodes += refitNodes;
+        _totalNodes += totalNodes;
+        _stepTime += std::chrono::steady_clock::now() - collisionTime;
         return collisions;
     };
 
@@ -152,8 +228,8 @@ public:
                 geometry::clearForce(nodesSet[i]);
             }
 
-            numCollisions =
-                anim::CollisionDetection::computeCollisions(aabbs, ksc);
+            numCollisions = anim::CollisionDetection::computeCollisions(
+                aabbs, ksc, 0.1f, _broadPhase);
 
             animSomas(aabbs, nodesSet);
 
@@ -195,10 +271,35 @@ public:
         }
     }
 
+    // Nodes move at most their radius per step and a continuous pass moves
+    // back the ones still going through others, so neurites do not cross.
+    // Springs stay unstable above their own time step limit
+    bool continuous;
+
+    // Reuses the candidate pairs of previous iterations while the nodes stay
+    // within the cache margin
+    bool cacheContacts;
+
 private:
     anim::ExplicitMassSpringSystem* _system;
 
     float _dt;
+
+    geometry::BroadPhasePtr _broadPhase;
+
+    geometry::BroadPhasePtr _continuousBroadPhase;
+
+    anim::ContactCache _contactCache;
+
+    std::chrono::duration<float> _collisionTime;
+
+    std::chrono::duration<float> _stepTime;
+
+    uint64_t _refitNodes;
+
+    uint64_t _totalNodes;
+
+    uint64_t _impacts;
 };
 
 }  // namespace examples
@@ -25,6 +25,7 @@
 #endif
 
 #include <stack>
+#include <unordered_map>
 
 using namespace phyanim;
 
@@ -34,7 +35,9 @@ Morpho::Morpho(std::string path,
                geometry::Mat4 mat,
                RadiusFunc radiusFunc,
                bool loadNeurites)
-    : color(0.2, 0.8, 0.2)
+    : soma(nullptr)
+    , aabb(nullptr)
+    , color(0.2, 0.8, 0.2)
     , collColor(1.0, 0.0, 0.0)
     , fixColor(0.2, 0.2, 0.2)
 {
@@ -79,9 +82,9 @@ Morpho::Morpho(std::string path,
                     position = mat * position;
 
                     float radius = currentSection.diameters()[i] * 0.5;
-                    node = new geometry::Node(position, nodeId, radius,
-                                              geometry::Vec3(),
-                                              geometry::Vec3(), radius);
+                    node = arena.create<geometry::Node>(
+                        position, nodeId, radius, geometry::Vec3(),
+                        geometry::Vec3(), radius);
                     ++nodeId;
                     nodes.push_back(node);
                     section->push_back(node);
@@ -98,8 +101,8 @@ Morpho::Morpho(std::string path,
         for (auto section : sections)
         {
             for (uint32_t i = 1; i < section->size(); ++i)
-                edges.push_back(
-                    new geometry::Edge((*section)[i - 1], (*section)[i]));
+                edges.push_back(arena.create<geometry::Edge>(
+                    (*section)[i - 1], (*section)[i]));
             delete section;
         }
         sections.clear();
@@ -112,7 +115,7 @@ Morpho::Morpho(std::string path,
         pos4 = mat * pos4;
         geometry::Vec3 pos(pos4);
         float radius = section.diameters()[0];
-        sectionNodes.push_back(new geometry::Node(
+        sectionNodes.push_back(arena.create<geometry::Node>(
             pos, 0, radius, geometry::Vec3(), geometry::Vec3(), radius));
     }
 
@@ -123,8 +126,8 @@ Morpho::Morpho(std::string path,
         pos4 = mat * pos4;
         geometry::Vec3 pos(pos4);
         float radius = morpho.soma().diameters()[i];
-        somaNodes.push_back(new geometry::Node(pos, 0, radius, geometry::Vec3(),
-                                               geometry::Vec3(), radius));
+        somaNodes.push_back(arena.create<geometry::Node>(
+            pos, 0, radius, geometry::Vec3(), geometry::Vec3(), radius));
     }
 
     morphio::Point c = morpho.soma().center();
@@ -178,8 +181,8 @@ Morpho::Morpho(std::string path,
         break;
     }
 
-    soma = new geometry::Node(center, 0, radius, geometry::Vec3(),
-                              geometry::Vec3(), radius);
+    soma = arena.create<geometry::Node>(center, 0, radius, geometry::Vec3(),
+                                        geometry::Vec3(), radius);
     soma->isSoma = true;
 
     // nodes.push_back(soma);
@@ -189,30 +192,47 @@ Morpho::Morpho(std::string path,
 #endif
 }
 
+Morpho::~Morpho()
+{
+    if (aabb) delete aabb;
+}
+
 void Morpho::cutout(geometry::AxisAlignedBoundingBox& other)
 {
     auto colEdges = aabb->collidingEdges(other);
     auto colNodes = geometry::uniqueNodes(colEdges);
 
-    std::unordered_set<geometry::Edge*> uEdges(colEdges.begin(),
-                                               colEdges.end());
-    std::unordered_set<geometry::NodePtr> uNodes(colNodes.begin(),
-                                                 colNodes.end());
-
-    if (!other.isColliding(*soma))
+    if (soma && !other.isColliding(*soma))
     {
-        for (auto node : somaNodes) delete node;
         somaNodes.clear();
         soma = nullptr;
     }
 
-    for (auto edge : edges)
-        if (uEdges.find(edge) == uEdges.end()) delete edge;
-    edges = colEdges;
+    // Kept objects are copied to a new arena, swapping it in releases the
+    // discarded ones
+    geometry::Arena kept;
+    std::unordered_map<geometry::NodePtr, geometry::NodePtr> copies;
+    auto copy = [&](geometry::NodePtr node)
+    {
+        auto& newNode = copies[node];
+        if (!newNode) newNode = kept.create<geometry::Node>(*node);
+        return newNode;
+    };
 
-    for (auto node : nodes)
-        if (uNodes.find(node) == uNodes.end()) delete node;
-    nodes = colNodes;
+    edges.resize(colEdges.size());
+    for (uint32_t i = 0; i < colEdges.size(); ++i)
+    {
+        auto edge = colEdges[i];
+        edges[i] = kept.create<geometry::Edge>(copy(edge->node0),
+                                               copy(edge->node1));
+        edges[i]->resLength = edge->resLength;
+    }
+    nodes.resize(colNodes.size());
+    for (uint32_t i = 0; i < colNodes.size(); ++i) nodes[i] = copy(colNodes[i]);
+    for (auto& node : somaNodes) node = copy(node);
+    for (auto& node : sectionNodes) node = copy(node);
+    if (soma) soma = copy(soma);
+    arena.swap(kept);
 
     delete aabb;
     aabb = new geometry::HierarchicalAABB(edges);
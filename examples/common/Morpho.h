@@ -45,12 +45,15 @@ public:
            RadiusFunc radiusFunc = RadiusFunc::MAX_NEURITES,
            bool loadNeurites = true);
 
-    ~Morpho(){};
+    ~Morpho();
 
     void print();
 
     void cutout(geometry::AxisAlignedBoundingBox& aabb);
 
+    // Owns every node and edge of the morphology, resample new edges into it
+    geometry::Arena arena;
+
     geometry::Nodes nodes;
 
     geometry::Nodes somaNodes;
@@ -20,15 +20,20 @@
 
 #include <phyanim/anim/AnimSystem.h>
 #include <phyanim/anim/CollisionDetection.h>
+#include <phyanim/anim/ContactCache.h>
 #include <phyanim/anim/ExplicitMassSpringSystem.h>
 #include <phyanim/anim/ImplicitFEMSystem.h>
+#include <phyanim/geometry/Arena.h>
 #include <phyanim/geometry/AxisAlignedBoundingBox.h>
+#include <phyanim/geometry/BlockSparseMatrix.h>
+#include <phyanim/geometry/BroadPhase.h>
 #include <phyanim/geometry/Edge.h>
 #include <phyanim/geometry/HierarchicalAABB.h>
 #include <phyanim/geometry/Math.h>
 #include <phyanim/geometry/Mesh.h>
 #include <phyanim/geometry/Node.h>
 #include <phyanim/geometry/Primitive.h>
+#include <phyanim/geometry/PrimitiveNodes.h>
 #include <phyanim/geometry/Tetrahedron.h>
 #include <phyanim/geometry/Triangle.h>
 #include <phyanim/graphics/Camera.h>
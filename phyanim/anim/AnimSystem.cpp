@@ -93,11 +93,13 @@ void AnimSystem::_update(geometry::Nodes& nodes)
     for (uint32_t i = 0; i < size; ++i)
     {
         auto node = nodes[i];
+        node->prevPosition = node->position;
         if (!node->fix && !node->isSoma)
         {
             geometry::Vec3 a = node->force / node->mass;
             geometry::Vec3 v = node->velocity + a * _dt;
             geometry::Vec3 x = node->position + v * _dt;
+            node->dirty = node->dirty || x != node->position;
             node->position = x;
             if (inertia) node->velocity = v;
         }
@@ -109,11 +111,13 @@ void AnimSystem::_updateIfCollide(geometry::Nodes& nodes)
     for (uint32_t i = 0; i < nodes.size(); ++i)
     {
         auto node = nodes[i];
+        node->prevPosition = node->position;
         if (!node->fix && !node->isSoma && node->collide)
         {
             geometry::Vec3 a = node->force / node->mass;
             geometry::Vec3 v = node->velocity + a * _dt;
             geometry::Vec3 x = node->position + v * _dt;
+            node->dirty = node->dirty || x != node->position;
             node->position = x;
             if (inertia) node->velocity = v;
         }
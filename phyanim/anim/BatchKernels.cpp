@@ -0,0 +1,344 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BatchKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && \
+    defined(__linux__)
+#define BATCH_KERNELS_TARGET_CLONES \
+    __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define BATCH_KERNELS_TARGET_CLONES
+#endif
+
+// Same degenerate edge length used by geometry::project
+#define BATCH_KERNELS_MIN_LENGTH 0.001f
+
+namespace phyanim
+{
+namespace anim
+{
+TriangleBatch::TriangleBatch() : size(0)
+{
+    std::memset(positions0, 0, sizeof(positions0));
+    std::memset(positions1, 0, sizeof(positions1));
+}
+
+void TriangleBatch::push(geometry::TrianglePtr t0, geometry::TrianglePtr t1)
+{
+    geometry::NodePtr nodes0[3] = {t0->node0, t0->node1, t0->node2};
+    geometry::NodePtr nodes1[3] = {t1->node0, t1->node1, t1->node2};
+    for (uint32_t v = 0; v < 3; ++v)
+    {
+        const geometry::Vec3& p0 = nodes0[v]->position;
+        const geometry::Vec3& p1 = nodes1[v]->position;
+        positions0[v * 3][size] = p0.x;
+        positions0[v * 3 + 1][size] = p0.y;
+        positions0[v * 3 + 2][size] = p0.z;
+        positions1[v * 3][size] = p1.x;
+        positions1[v * 3 + 1][size] = p1.y;
+        positions1[v * 3 + 2][size] = p1.z;
+    }
+    triangles0[size] = t0;
+    triangles1[size] = t1;
+    ++size;
+}
+
+// The helpers use integer masks and selects whose conditions are evaluated
+// unconditionally, so the kernel loop is vectorized without fast-math flags
+EdgeBatch::EdgeBatch() : size(0)
+{
+    std::memset(positions0, 0, sizeof(positions0));
+    std::memset(positions1, 0, sizeof(positions1));
+    std::memset(radii, 0, sizeof(radii));
+}
+
+void EdgeBatch::push(geometry::Edge* e0, geometry::Edge* e1)
+{
+    geometry::NodePtr nodes0[2] = {e0->node0, e0->node1};
+    geometry::NodePtr nodes1[2] = {e1->node0, e1->node1};
+    for (uint32_t v = 0; v < 2; ++v)
+    {
+        const geometry::Vec3& p0 = nodes0[v]->position;
+        const geometry::Vec3& p1 = nodes1[v]->position;
+        positions0[v * 3][size] = p0.x;
+        positions0[v * 3 + 1][size] = p0.y;
+        positions0[v * 3 + 2][size] = p0.z;
+        positions1[v * 3][size] = p1.x;
+        positions1[v * 3 + 1][size] = p1.y;
+        positions1[v * 3 + 2][size] = p1.z;
+    }
+    radii[size] = std::max(e0->node0->radius, e0->node1->radius) +
+                  std::max(e1->node0->radius, e1->node1->radius);
+    edges0[size] = e0;
+    edges1[size] = e1;
+    ++size;
+}
+
+static inline int32_t sign(float value)
+{
+    return (int32_t)(value > 0.0f) - (int32_t)(value < 0.0f);
+}
+
+// Index of the vertex on the opposite side of the plane from the other two
+static inline int32_t isolatedVertex(float d0, float d1, float d2)
+{
+    int32_t s0 = sign(d0);
+    int32_t s1 = sign(d1);
+    int32_t s2 = sign(d2);
+    int32_t isolated = s1 != s2;
+    int32_t second = s0 == s2;
+    return isolated * (2 - second);
+}
+
+static inline float rotate(int32_t offset, float v0, float v1, float v2)
+{
+    float value = offset == 1 ? v1 : v2;
+    return offset == 0 ? v0 : value;
+}
+
+static inline int32_t sameSide(float d0, float d1, float d2)
+{
+    return ((d0 > 0.0f) & (d1 > 0.0f) & (d2 > 0.0f)) |
+           ((d0 < 0.0f) & (d1 < 0.0f) & (d2 < 0.0f));
+}
+
+// numerator / denominator, or 0 when discarded and the numerator is finite.
+// Only the denominator is selected so the division is never moved into a
+// conditional block
+static inline float ratio(int32_t discard, float numerator, float denominator)
+{
+    return numerator /
+           (discard ? std::numeric_limits<float>::infinity() : denominator);
+}
+
+// Arithmetic clamp to [0, 1], selects with constant values let GCC split the
+// loop body into conditional paths
+static inline float clampUnit(float value)
+{
+    return 0.5f * (std::fabs(value) - std::fabs(value - 1.0f) + 1.0f);
+}
+
+// Projection of p over the segment ab, q = a + (b - a) * t
+static inline void projectPoint(float px,
+                                float py,
+                                float pz,
+                                float ax,
+                                float ay,
+                                float az,
+                                float bx,
+                                float by,
+                                float bz,
+                                float& t,
+                                float& qx,
+                                float& qy,
+                                float& qz)
+{
+    float abx = bx - ax;
+    float aby = by - ay;
+    float abz = bz - az;
+    float length2 = abx * abx + aby * aby + abz * abz;
+    float dot = (px - ax) * abx + (py - ay) * aby + (pz - az) * abz;
+    int32_t degenerate =
+        length2 < BATCH_KERNELS_MIN_LENGTH * BATCH_KERNELS_MIN_LENGTH;
+    t = clampUnit(ratio(degenerate, dot, length2));
+    qx = ax * (1.0f - t) + bx * t;
+    qy = ay * (1.0f - t) + by * t;
+    qz = az * (1.0f - t) + bz * t;
+}
+
+BATCH_KERNELS_TARGET_CLONES
+uint32_t intersectTriangles(TriangleBatch& batch)
+{
+    uint32_t numHits = 0;
+    uint32_t size = batch.size;
+    const float(*a)[BATCH_KERNELS_SIZE] = batch.positions0;
+    const float(*b)[BATCH_KERNELS_SIZE] = batch.positions1;
+
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp simd reduction(+ : numHits)
+#endif
+    for (uint32_t i = 0; i < BATCH_KERNELS_SIZE; ++i)
+    {
+        float ux = a[3][i] - a[0][i];
+        float uy = a[4][i] - a[1][i];
+        float uz = a[5][i] - a[2][i];
+        float wx = a[6][i] - a[0][i];
+        float wy = a[7][i] - a[1][i];
+        float wz = a[8][i] - a[2][i];
+        float n0x = uy * wz - uz * wy;
+        float n0y = uz * wx - ux * wz;
+        float n0z = ux * wy - uy * wx;
+        float d0 = -(n0x * a[0][i] + n0y * a[1][i] + n0z * a[2][i]);
+
+        float dt10 = n0x * b[0][i] + n0y * b[1][i] + n0z * b[2][i] + d0;
+        float dt11 = n0x * b[3][i] + n0y * b[4][i] + n0z * b[5][i] + d0;
+        float dt12 = n0x * b[6][i] + n0y * b[7][i] + n0z * b[8][i] + d0;
+
+        ux = b[3][i] - b[0][i];
+        uy = b[4][i] - b[1][i];
+        uz = b[5][i] - b[2][i];
+        wx = b[6][i] - b[0][i];
+        wy = b[7][i] - b[1][i];
+        wz = b[8][i] - b[2][i];
+        float n1x = uy * wz - uz * wy;
+        float n1y = uz * wx - ux * wz;
+        float n1z = ux * wy - uy * wx;
+        float d1 = -(n1x * b[0][i] + n1y * b[1][i] + n1z * b[2][i]);
+
+        float dt00 = n1x * a[0][i] + n1y * a[1][i] + n1z * a[2][i] + d1;
+        float dt01 = n1x * a[3][i] + n1y * a[4][i] + n1z * a[5][i] + d1;
+        float dt02 = n1x * a[6][i] + n1y * a[7][i] + n1z * a[8][i] + d1;
+
+        float dx = n0y * n1z - n0z * n1y;
+        float dy = n0z * n1x - n0x * n1z;
+        float dz = n0x * n1y - n0y * n1x;
+
+        float pt00 = dx * a[0][i] + dy * a[1][i] + dz * a[2][i];
+        float pt01 = dx * a[3][i] + dy * a[4][i] + dz * a[5][i];
+        float pt02 = dx * a[6][i] + dy * a[7][i] + dz * a[8][i];
+        float pt10 = dx * b[0][i] + dy * b[1][i] + dz * b[2][i];
+        float pt11 = dx * b[3][i] + dy * b[4][i] + dz * b[5][i];
+        float pt12 = dx * b[6][i] + dy * b[7][i] + dz * b[8][i];
+
+        // Interval of each triangle over the planes intersection line
+        int32_t off0 = isolatedVertex(dt00, dt01, dt02);
+        float p0a = rotate(off0, pt00, pt01, pt02);
+        float p0b = rotate(off0, pt01, pt02, pt00);
+        float p0c = rotate(off0, pt02, pt00, pt01);
+        float d0a = rotate(off0, dt00, dt01, dt02);
+        float d0b = rotate(off0, dt01, dt02, dt00);
+        float d0c = rotate(off0, dt02, dt00, dt01);
+        float i00 = p0b + (p0a - p0b) * d0b / (d0b - d0a);
+        float i01 = p0c + (p0a - p0c) * d0c / (d0c - d0a);
+
+        int32_t off1 = isolatedVertex(dt10, dt11, dt12);
+        float p1a = rotate(off1, pt10, pt11, pt12);
+        float p1b = rotate(off1, pt11, pt12, pt10);
+        float p1c = rotate(off1, pt12, pt10, pt11);
+        float d1a = rotate(off1, dt10, dt11, dt12);
+        float d1b = rotate(off1, dt11, dt12, dt10);
+        float d1c = rotate(off1, dt12, dt10, dt11);
+        float i10 = p1b + (p1a - p1b) * d1b / (d1b - d1a);
+        float i11 = p1c + (p1a - p1c) * d1c / (d1c - d1a);
+
+        int32_t swap0 = i00 > i01;
+        float min0 = swap0 ? i01 : i00;
+        float max0 = swap0 ? i00 : i01;
+        int32_t swap1 = i10 > i11;
+        float min1 = swap1 ? i11 : i10;
+        float max1 = swap1 ? i10 : i11;
+
+        int32_t hit = (i < size) & !sameSide(dt10, dt11, dt12) &
+                      !sameSide(dt00, dt01, dt02) & (max0 >= min1) &
+                      (max1 >= min0);
+
+        batch.distances0[0][i] = dt00;
+        batch.distances0[1][i] = dt01;
+        batch.distances0[2][i] = dt02;
+        batch.distances1[0][i] = dt10;
+        batch.distances1[1][i] = dt11;
+        batch.distances1[2][i] = dt12;
+        batch.normals0[0][i] = n0x;
+        batch.normals0[1][i] = n0y;
+        batch.normals0[2][i] = n0z;
+        batch.normals1[0][i] = n1x;
+        batch.normals1[1][i] = n1y;
+        batch.normals1[2][i] = n1z;
+        batch.hits[i] = hit;
+        numHits += hit;
+    }
+    return numHits;
+}
+
+BATCH_KERNELS_TARGET_CLONES
+uint32_t intersectEdges(EdgeBatch& batch)
+{
+    uint32_t numHits = 0;
+    uint32_t size = batch.size;
+    const float(*e0)[BATCH_KERNELS_SIZE] = batch.positions0;
+    const float(*e1)[BATCH_KERNELS_SIZE] = batch.positions1;
+    const float minLength2 =
+        BATCH_KERNELS_MIN_LENGTH * BATCH_KERNELS_MIN_LENGTH;
+
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp simd reduction(+ : numHits)
+#endif
+    for (uint32_t i = 0; i < BATCH_KERNELS_SIZE; ++i)
+    {
+        float ax = e0[0][i], ay = e0[1][i], az = e0[2][i];
+        float bx = e0[3][i], by = e0[4][i], bz = e0[5][i];
+        float cx = e1[0][i], cy = e1[1][i], cz = e1[2][i];
+        float dx = e1[3][i], dy = e1[4][i], dz = e1[5][i];
+
+        float bax = bx - ax, bay = by - ay, baz = bz - az;
+        float dcx = dx - cx, dcy = dy - cy, dcz = dz - cz;
+        float l02 = bax * bax + bay * bay + baz * baz;
+        float l12 = dcx * dcx + dcy * dcy + dcz * dcz;
+
+        // First guess over ab from the projection of ab over the cd line
+        int32_t degenerate1 = l12 < minLength2;
+        float sa = ratio(degenerate1,
+                         (ax - cx) * dcx + (ay - cy) * dcy + (az - cz) * dcz,
+                         l12);
+        float sb = ratio(degenerate1,
+                         (bx - cx) * dcx + (by - cy) * dcy + (bz - cz) * dcz,
+                         l12);
+        float apx = ax - dcx * sa, apy = ay - dcy * sa, apz = az - dcz * sa;
+        float bpx = bx - dcx * sb, bpy = by - dcy * sb, bpz = bz - dcz * sb;
+        float bapx = bpx - apx, bapy = bpy - apy, bapz = bpz - apz;
+        float lbap2 = bapx * bapx + bapy * bapy + bapz * bapz;
+        // A degenerate ab starts at a, a degenerate cd makes the guess
+        // irrelevant as its projection is always c
+        float dot = (cx - apx) * bapx + (cy - apy) * bapy + (cz - apz) * bapz;
+        int32_t degenerate = (l02 < minLength2) | (lbap2 < minLength2);
+        float t0 = clampUnit(ratio(degenerate, dot, lbap2));
+        float p0x = ax * (1.0f - t0) + bx * t0;
+        float p0y = ay * (1.0f - t0) + by * t0;
+        float p0z = az * (1.0f - t0) + bz * t0;
+
+        float t1, p1x, p1y, p1z;
+        projectPoint(p0x, p0y, p0z, cx, cy, cz, dx, dy, dz, t1, p1x, p1y, p1z);
+        projectPoint(p1x, p1y, p1z, ax, ay, az, bx, by, bz, t0, p0x, p0y, p0z);
+
+        float vx = p1x - p0x;
+        float vy = p1y - p0y;
+        float vz = p1z - p0z;
+        float distance2 = vx * vx + vy * vy + vz * vz;
+        float radius = batch.radii[i];
+
+        int32_t hit = (i < size) & (distance2 < radius * radius);
+
+        batch.weights0[i] = t0;
+        batch.weights1[i] = t1;
+        batch.directions[0][i] = vx;
+        batch.directions[1][i] = vy;
+        batch.directions[2][i] = vz;
+        batch.squaredDistances[i] = distance2;
+        batch.hits[i] = hit;
+        numHits += hit;
+    }
+    return numHits;
+}
+
+}  // namespace anim
+}  // namespace phyanim
@@ -0,0 +1,106 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_BATCH_KERNELS__
+#define __PHYANIM_BATCH_KERNELS__
+
+#include "../geometry/Triangle.h"
+
+#define BATCH_KERNELS_SIZE 16
+
+namespace phyanim
+{
+namespace anim
+{
+// Structure of arrays batch of triangle pairs, one lane per pair. Positions
+// are stored as [vertex * 3 + axis][lane]
+typedef struct TriangleBatch
+{
+    alignas(64) float positions0[9][BATCH_KERNELS_SIZE];
+    alignas(64) float positions1[9][BATCH_KERNELS_SIZE];
+
+    // Signed distances of each triangle vertices to the other triangle plane
+    alignas(64) float distances0[3][BATCH_KERNELS_SIZE];
+    alignas(64) float distances1[3][BATCH_KERNELS_SIZE];
+
+    // Normals of each triangle, not normalized
+    alignas(64) float normals0[3][BATCH_KERNELS_SIZE];
+    alignas(64) float normals1[3][BATCH_KERNELS_SIZE];
+
+    alignas(64) int32_t hits[BATCH_KERNELS_SIZE];
+
+    geometry::TrianglePtr triangles0[BATCH_KERNELS_SIZE];
+    geometry::TrianglePtr triangles1[BATCH_KERNELS_SIZE];
+
+    uint32_t size;
+
+    TriangleBatch();
+
+    void push(geometry::TrianglePtr t0, geometry::TrianglePtr t1);
+
+    bool full() const { return size == BATCH_KERNELS_SIZE; };
+} TriangleBatch;
+
+// Structure of arrays batch of edge pairs, tested as capsules whose radius is
+// the largest of their nodes. Positions are stored as [vertex * 3 + axis][lane]
+typedef struct EdgeBatch
+{
+    alignas(64) float positions0[6][BATCH_KERNELS_SIZE];
+    alignas(64) float positions1[6][BATCH_KERNELS_SIZE];
+
+    // Sum of both capsule radii
+    alignas(64) float radii[BATCH_KERNELS_SIZE];
+
+    // Closest points parameters along each edge
+    alignas(64) float weights0[BATCH_KERNELS_SIZE];
+    alignas(64) float weights1[BATCH_KERNELS_SIZE];
+
+    // Vector from the closest point of the first edge to the second one
+    alignas(64) float directions[3][BATCH_KERNELS_SIZE];
+
+    alignas(64) float squaredDistances[BATCH_KERNELS_SIZE];
+
+    alignas(64) int32_t hits[BATCH_KERNELS_SIZE];
+
+    geometry::Edge* edges0[BATCH_KERNELS_SIZE];
+    geometry::Edge* edges1[BATCH_KERNELS_SIZE];
+
+    uint32_t size;
+
+    EdgeBatch();
+
+    void push(geometry::Edge* e0, geometry::Edge* e1);
+
+    bool full() const { return size == BATCH_KERNELS_SIZE; };
+} EdgeBatch;
+
+// Moller's triangle-triangle test evaluated for every lane without branches.
+// Fills distances, normals and hits, and returns the number of hits. On x86-64
+// Linux builds with GCC the kernel is compiled for AVX-512, AVX2 and a
+// generic target, and the best one is chosen at load time
+uint32_t intersectTriangles(TriangleBatch& batch);
+
+// Segment-segment closest points as computed by geometry::project, evaluated
+// for every lane without branches. Fills weights, directions, squared
+// distances and hits, and returns the number of hits. Dispatched as
+// intersectTriangles
+uint32_t intersectEdges(EdgeBatch& batch);
+
+}  // namespace anim
+}  // namespace phyanim
+
+#endif  // __PHYANIM_BATCH_KERNELS__
@@ -17,53 +17,89 @@
 
 #include "CollisionDetection.h"
 
+#include <atomic>
+#include <cmath>
 #include <iostream>
 
+#include "../geometry/PrimitiveNodes.h"
+
+// Tree pairs with fewer nodes than this are traversed by a single task
+#define COLLISION_DETECTION_TASK_NODES 4096
+
+// Levels of the descent of larger pairs split in tasks
+#define COLLISION_DETECTION_TASK_DEPTH 4
+
+// Candidate pairs tested by each task of a pair list narrow phase
+#define COLLISION_DETECTION_CHUNK_SIZE 1024
+
+// Conservative advancement steps of a time of impact query, each one stops
+// half the tolerance before the closest possible contact
+#define COLLISION_DETECTION_MAX_ADVANCEMENTS 32
+
 namespace phyanim
 {
 namespace anim
 {
+bool CollisionDetection::batchKernels = true;
+
+bool CollisionDetection::deterministicContacts = false;
+
 uint32_t CollisionDetection::computeCollisions(
     geometry::HierarchicalAABBs& aabbs,
     float stiffness,
-    float threshold)
+    float threshold,
+    geometry::BroadPhasePtr broadPhase)
 {
-    uint32_t size = aabbs.size();
-    std::vector<uint32_t> collisions(size * size);
+    auto pairs = _collidingPairs(aabbs, broadPhase);
+    uint32_t size = pairs.size();
+    std::atomic<uint32_t> numCollisions(0);
+    ContactBuffer contacts(deterministicContacts);
+
+    // One task per pair, large pairs split themselves in more tasks that the
+    // runtime balances across threads
 #ifdef PHYANIM_USES_OPENMP
-#pragma omp parallel for
+#pragma omp parallel
+#pragma omp single
 #endif
     for (unsigned int i = 0; i < size; ++i)
     {
-        auto aabb0 = aabbs[i];
-        for (unsigned int j = i + 1; j < size; ++j)
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp task shared(aabbs, pairs, numCollisions, contacts)
+#endif
         {
-            auto aabb1 = aabbs[j];
-            collisions[i * size + j] =
-                _computeCollision(aabb0, aabb1, stiffness, threshold);
+            auto aabb0 = aabbs[pairs[i].first];
+            auto aabb1 = aabbs[pairs[i].second];
+            numCollisions += _computeCollision(aabb0, aabb1, contacts,
+                                               stiffness, threshold);
         }
     }
-
-    uint32_t numCollisions = 0;
-    for (auto collision : collisions) numCollisions += collision;
-
+    contacts.apply();
     return numCollisions;
-}  // namespace phyanim
+}
 
 uint32_t CollisionDetection::computeSelfCollisions(
     geometry::HierarchicalAABBs& aabbs,
     float stiffness,
     float threshold)
 {
-    uint32_t numCollisions = 0;
+    uint32_t size = aabbs.size();
+    std::atomic<uint32_t> numCollisions(0);
+    ContactBuffer contacts(deterministicContacts);
+
+    // Passing the same tree twice runs its self collision traversal
 #ifdef PHYANIM_USES_OPENMP
-#pragma omp parallel for
+#pragma omp parallel
+#pragma omp single
 #endif
-    for (unsigned int i = 0; i < aabbs.size(); ++i)
+    for (unsigned int i = 0; i < size; ++i)
     {
-        numCollisions +=
-            _computeCollision(aabbs[i], aabbs[i], stiffness, threshold);
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp task shared(aabbs, numCollisions, contacts)
+#endif
+        numCollisions += _computeCollision(aabbs[i], aabbs[i], contacts,
+                                           stiffness, threshold);
     }
+    contacts.apply();
     return numCollisions;
 }
 
@@ -72,7 +108,11 @@ uint32_t CollisionDetection::computeCollisions(
     float stiffness,
     float threshold)
 {
-    return _computeCollision(aabb, aabb, stiffness, threshold);
+    ContactBuffer contacts(deterministicContacts);
+    uint32_t numCollisions =
+        _computeCollision(aabb, aabb, contacts, stiffness, threshold);
+    contacts.apply();
+    return numCollisions;
 }
 
 bool CollisionDetection::computeCollisions(geometry::Meshes& meshes,
@@ -84,6 +124,40 @@ bool CollisionDetection::computeCollisions(geometry::Meshes& meshes,
     return computeCollisions(aabbs, stiffness, threshold);
 }
 
+uint32_t CollisionDetection::computeCollisions(
+    const geometry::PrimitivePairs& pairs,
+    float stiffness,
+    float threshold)
+{
+    uint32_t size = pairs.size();
+    uint32_t numChunks = (size + COLLISION_DETECTION_CHUNK_SIZE - 1) /
+                         COLLISION_DETECTION_CHUNK_SIZE;
+    uint32_t numCollisions = 0;
+    ContactBuffer contacts(deterministicContacts);
+
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+ : numCollisions)
+#endif
+    for (uint32_t i = 0; i < numChunks; ++i)
+    {
+        TriangleBatch triangleBatch;
+        EdgeBatch edgeBatch;
+        uint32_t begin = i * COLLISION_DETECTION_CHUNK_SIZE;
+        uint32_t end = std::min(begin + COLLISION_DETECTION_CHUNK_SIZE, size);
+        numCollisions += _checkCollisions(&pairs[begin], end - begin,
+                                          triangleBatch, edgeBatch, contacts,
+                                          stiffness, threshold, true);
+        if (triangleBatch.size > 0)
+            numCollisions +=
+                _checkCollisions(triangleBatch, contacts, stiffness);
+        if (edgeBatch.size > 0)
+            numCollisions +=
+                _checkCollisions(edgeBatch, contacts, stiffness, threshold);
+    }
+    contacts.apply();
+    return numCollisions;
+}
+
 void CollisionDetection::computeCollisions(
     geometry::HierarchicalAABBs& aabbs,
     const geometry::AxisAlignedBoundingBox& aabb)
@@ -135,6 +209,7 @@ void CollisionDetection::computeCollisions(
             {
                 node->position = pos;
                 node->velocity = geometry::Vec3();
+                node->dirty = true;
             }
         }
     }
@@ -149,34 +224,63 @@ void CollisionDetection::computeCollisions(
     computeCollisions(aabbs, aabb);
 }
 
+uint32_t CollisionDetection::computeContinuousCollisions(
+    geometry::HierarchicalAABBs& aabbs,
+    float tolerance,
+    geometry::BroadPhasePtr broadPhase)
+{
+    auto pairs = _collidingPairs(aabbs, broadPhase);
+    uint32_t size = pairs.size();
+    std::atomic<uint32_t> numImpacts(0);
+    ContactBuffer contacts;
+
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel
+#pragma omp single
+#endif
+    for (unsigned int i = 0; i < size; ++i)
+    {
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp task shared(aabbs, pairs, numImpacts, contacts)
+#endif
+        numImpacts += _computeContinuousCollision(
+            aabbs[pairs[i].first], aabbs[pairs[i].second], contacts,
+            tolerance);
+    }
+    contacts.apply();
+    return numImpacts;
+}
+
 geometry::AxisAlignedBoundingBoxes CollisionDetection::collisionBoundingBoxes(
     geometry::HierarchicalAABBs& aabbs,
-    float sizeFactor)
+    float sizeFactor,
+    geometry::BroadPhasePtr broadPhase)
 {
     geometry::AxisAlignedBoundingBoxes boundingBoxes;
 
     uint32_t numSomas = 0;
     std::unordered_set<geometry::PrimitivePtr> uPrims;
+    ContactBuffer contacts;
 
-    for (uint64_t i = 0; i < aabbs.size(); ++i)
+    for (auto aabbPair : _collidingPairs(aabbs, broadPhase))
     {
-        for (uint64_t j = i + 1; j < aabbs.size(); ++j)
-        {
-            auto aabb0 = aabbs[i];
-            auto aabb1 = aabbs[j];
-            auto pairs = aabb0->collidingPrimitives(aabb1);
+        auto aabb0 = aabbs[aabbPair.first];
+        auto aabb1 = aabbs[aabbPair.second];
+        auto pairs = aabb0->collidingPrimitives(aabb1);
 
-            for (auto pair : pairs)
+        for (auto pair : pairs)
+        {
+            if (_checkCollision(pair.first, pair.second, contacts, 0.0f, 0.0f,
+                                false))
             {
-                if (_checkCollision(pair.first, pair.second, 0, false))
-                {
-                    uPrims.insert(pair.first);
-                    uPrims.insert(pair.second);
-                }
+                uPrims.insert(pair.first);
+                uPrims.insert(pair.second);
             }
         }
     }
 
+    contacts.apply();
+
     for (auto p : uPrims)
     {
         if (!p->isSoma())
@@ -206,49 +310,150 @@ geometry::AxisAlignedBoundingBoxes CollisionDetection::collisionBoundingBoxes(
     return collisionBoundingBoxes(aabbs, sizeFactor);
 }
 
+geometry::IndexPairs CollisionDetection::_collidingPairs(
+    geometry::HierarchicalAABBs& aabbs,
+    geometry::BroadPhasePtr broadPhase)
+{
+    if (broadPhase) return broadPhase->collidingPairs(aabbs);
+    geometry::SweepAndPrune sweepAndPrune;
+    return sweepAndPrune.collidingPairs(aabbs);
+}
+
+uint32_t CollisionDetection::_computeCollision(
+    geometry::HierarchicalAABBPtr aabb0,
+    geometry::HierarchicalAABBPtr aabb1,
+    ContactBuffer& contacts,
+    float stiffness,
+    float threshold)
+{
+    if (aabb0->numNodes() == 0 || aabb1->numNodes() == 0) return 0;
+    if (aabb0->numNodes() + aabb1->numNodes() < COLLISION_DETECTION_TASK_NODES)
+        return _computeCollision(aabb0, 0, aabb1, 0, contacts, stiffness,
+                                 threshold);
+
+    auto nodePairs =
+        aabb0 == aabb1
+            ? aabb0->selfCollidingNodes(COLLISION_DETECTION_TASK_DEPTH)
+            : aabb0->collidingNodes(aabb1, COLLISION_DETECTION_TASK_DEPTH);
+    uint32_t size = nodePairs.size();
+    std::atomic<uint32_t> numCollisions(0);
+    for (uint32_t i = 0; i < size; ++i)
+    {
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp task shared(nodePairs, numCollisions, contacts)
+#endif
+        numCollisions += _computeCollision(aabb0, nodePairs[i].first, aabb1,
+                                           nodePairs[i].second, contacts,
+                                           stiffness, threshold);
+    }
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp taskwait
+#endif
+    return numCollisions;
+}
+
 uint32_t CollisionDetection::_computeCollision(
     geometry::HierarchicalAABBPtr aabb0,
+    uint32_t id0,
     geometry::HierarchicalAABBPtr aabb1,
+    uint32_t id1,
+    ContactBuffer& contacts,
     float stiffness,
     float threshold)
 {
     uint32_t numCollisions = 0;
-    auto pairs = aabb0->collidingPrimitives(aabb1);
+    TriangleBatch triangleBatch;
+    EdgeBatch edgeBatch;
+
+    // Pairs are streamed from the traversal with their limits already
+    // checked
+    geometry::PrimitivePairsCallback callback =
+        [&](const geometry::PrimitivePair* pairs, uint32_t size) {
+            numCollisions +=
+                _checkCollisions(pairs, size, triangleBatch, edgeBatch,
+                                 contacts, stiffness, threshold);
+        };
+    if (aabb0 == aabb1)
+        aabb0->selfCollidingPrimitives(id0, id1, callback);
+    else
+        aabb0->collidingPrimitives(aabb1, id0, id1, callback);
+    if (triangleBatch.size > 0)
+        numCollisions += _checkCollisions(triangleBatch, contacts, stiffness);
+    if (edgeBatch.size > 0)
+        numCollisions +=
+            _checkCollisions(edgeBatch, contacts, stiffness, threshold);
+    return numCollisions;
+}
 
-    for (unsigned int i = 0; i < pairs.size(); i++)
+uint32_t CollisionDetection::_checkCollisions(
+    const geometry::PrimitivePair* pairs,
+    uint32_t size,
+    TriangleBatch& triangleBatch,
+    EdgeBatch& edgeBatch,
+    ContactBuffer& contacts,
+    float stiffness,
+    float threshold,
+    bool checkLimits)
+{
+    uint32_t numCollisions = 0;
+    for (uint32_t i = 0; i < size; ++i)
     {
-        auto pair = pairs[i];
-
-        if (!pair.first->areLimitsColliding(pair.second)) continue;
-        if (_checkCollision(pair.first, pair.second, stiffness, threshold))
-            ++numCollisions;
+        auto& pair = pairs[i];
+        if (checkLimits && !pair.first->areLimitsColliding(pair.second))
+            continue;
+        auto type = pair.first->type();
+        if (!batchKernels || type != pair.second->type())
+        {
+            if (_checkCollision(pair.first, pair.second, contacts, stiffness,
+                                threshold))
+                ++numCollisions;
+        }
+        else if (type == geometry::TRIANGLE)
+        {
+            triangleBatch.push(static_cast<geometry::TrianglePtr>(pair.first),
+                               static_cast<geometry::TrianglePtr>(pair.second));
+            if (triangleBatch.full())
+                numCollisions +=
+                    _checkCollisions(triangleBatch, contacts, stiffness);
+        }
+        else if (type == geometry::EDGE)
+        {
+            edgeBatch.push(static_cast<geometry::Edge*>(pair.first),
+                           static_cast<geometry::Edge*>(pair.second));
+            if (edgeBatch.full())
+                numCollisions += _checkCollisions(edgeBatch, contacts,
+                                                  stiffness, threshold);
+        }
     }
     return numCollisions;
 }
 
 bool CollisionDetection::_checkCollision(geometry::PrimitivePtr p0,
                                          geometry::PrimitivePtr p1,
+                                         ContactBuffer& contacts,
                                          float stiffness,
                                          float threshold,
                                          bool setForces)
 {
-    auto t0 = dynamic_cast<geometry::TrianglePtr>(p0);
-    auto t1 = dynamic_cast<geometry::TrianglePtr>(p1);
-    if (t0 && t1)
+    if (p0->type() != p1->type()) return false;
+    switch (p0->type())
     {
-        return _checkCollision(t0, t1, stiffness, setForces);
-    }
-    else
-    {
-        auto e0 = dynamic_cast<geometry::Edge*>(p0);
-        auto e1 = dynamic_cast<geometry::Edge*>(p1);
-        return _checkCollision(e0, e1, stiffness, threshold, setForces);
+    case geometry::TRIANGLE:
+        return _checkCollision(static_cast<geometry::TrianglePtr>(p0),
+                               static_cast<geometry::TrianglePtr>(p1),
+                               contacts, stiffness, setForces);
+    case geometry::EDGE:
+        return _checkCollision(static_cast<geometry::Edge*>(p0),
+                               static_cast<geometry::Edge*>(p1), contacts,
+                               stiffness, threshold, setForces);
+    default:
+        return false;
     }
-    return false;
 }
 
 bool CollisionDetection::_checkCollision(geometry::TrianglePtr t0,
                                          geometry::TrianglePtr t1,
+                                         ContactBuffer& contacts,
                                          float stiffness,
                                          bool setForces)
 {
@@ -373,25 +578,117 @@ bool CollisionDetection::_checkCollision(geometry::TrianglePtr t0,
     {
         n0 = glm::normalize(n0);
         n1 = glm::normalize(n1);
-        _checkAndSetForce(t0->node0, n1, dt0[0], stiffness);
-        _checkAndSetForce(t0->node1, n1, dt0[1], stiffness);
-        _checkAndSetForce(t0->node2, n1, dt0[2], stiffness);
-        _checkAndSetForce(t1->node0, n0, dt1[0], stiffness);
-        _checkAndSetForce(t1->node1, n0, dt1[1], stiffness);
-        _checkAndSetForce(t1->node2, n0, dt1[2], stiffness);
+        _checkAndSetForce(contacts, t0->node0, n1, dt0[0], stiffness);
+        _checkAndSetForce(contacts, t0->node1, n1, dt0[1], stiffness);
+        _checkAndSetForce(contacts, t0->node2, n1, dt0[2], stiffness);
+        _checkAndSetForce(contacts, t1->node0, n0, dt1[0], stiffness);
+        _checkAndSetForce(contacts, t1->node1, n0, dt1[1], stiffness);
+        _checkAndSetForce(contacts, t1->node2, n0, dt1[2], stiffness);
+    }
+    else
+    {
+        contacts.add(t0->node0);
+        contacts.add(t0->node1);
+        contacts.add(t0->node2);
+        contacts.add(t1->node0);
+        contacts.add(t1->node1);
+        contacts.add(t1->node2);
     }
-
-    t0->node0->collide = true;
-    t0->node1->collide = true;
-    t0->node2->collide = true;
-    t1->node0->collide = true;
-    t1->node1->collide = true;
-    t1->node2->collide = true;
     return true;
 }
 
+uint32_t CollisionDetection::_checkCollisions(TriangleBatch& batch,
+                                              ContactBuffer& contacts,
+                                              float stiffness,
+                                              bool setForces)
+{
+    uint32_t numCollisions = intersectTriangles(batch);
+
+    // Forces are applied in pair order to keep results deterministic
+    for (uint32_t i = 0; numCollisions > 0 && i < batch.size; ++i)
+    {
+        if (!batch.hits[i]) continue;
+        auto t0 = batch.triangles0[i];
+        auto t1 = batch.triangles1[i];
+        if (setForces)
+        {
+            geometry::Vec3 n0 = glm::normalize(geometry::Vec3(
+                batch.normals0[0][i], batch.normals0[1][i],
+                batch.normals0[2][i]));
+            geometry::Vec3 n1 = glm::normalize(geometry::Vec3(
+                batch.normals1[0][i], batch.normals1[1][i],
+                batch.normals1[2][i]));
+            _checkAndSetForce(contacts, t0->node0, n1,
+                              batch.distances0[0][i], stiffness);
+            _checkAndSetForce(contacts, t0->node1, n1,
+                              batch.distances0[1][i], stiffness);
+            _checkAndSetForce(contacts, t0->node2, n1,
+                              batch.distances0[2][i], stiffness);
+            _checkAndSetForce(contacts, t1->node0, n0,
+                              batch.distances1[0][i], stiffness);
+            _checkAndSetForce(contacts, t1->node1, n0,
+                              batch.distances1[1][i], stiffness);
+            _checkAndSetForce(contacts, t1->node2, n0,
+                              batch.distances1[2][i], stiffness);
+        }
+        else
+        {
+            contacts.add(t0->node0);
+            contacts.add(t0->node1);
+            contacts.add(t0->node2);
+            contacts.add(t1->node0);
+            contacts.add(t1->node1);
+            contacts.add(t1->node2);
+        }
+    }
+    batch.size = 0;
+    return numCollisions;
+}
+
+uint32_t CollisionDetection::_checkCollisions(EdgeBatch& batch,
+                                              ContactBuffer& contacts,
+                                              float stiffness,
+                                              float threshold,
+                                              bool setForces)
+{
+    uint32_t numCollisions = intersectEdges(batch);
+
+    // Forces are scattered in pair order to keep results deterministic
+    for (uint32_t i = 0; numCollisions > 0 && i < batch.size; ++i)
+    {
+        if (!batch.hits[i]) continue;
+        auto e0 = batch.edges0[i];
+        auto e1 = batch.edges1[i];
+        if (setForces)
+        {
+            float t0 = batch.weights0[i];
+            float t1 = batch.weights1[i];
+            float dis = std::sqrt(batch.squaredDistances[i]) - batch.radii[i];
+            if (dis > -threshold) dis = -threshold;
+            geometry::Vec3 dir = glm::normalize(geometry::Vec3(
+                batch.directions[0][i], batch.directions[1][i],
+                batch.directions[2][i]));
+            auto f = dir * stiffness * dis;
+            contacts.add(e0->node0, f * (1.0f - t0));
+            contacts.add(e0->node1, f * t0);
+            contacts.add(e1->node0, -f * (1.0f - t1));
+            contacts.add(e1->node1, -f * t1);
+        }
+        else
+        {
+            contacts.add(e0->node0);
+            contacts.add(e0->node1);
+            contacts.add(e1->node0);
+            contacts.add(e1->node1);
+        }
+    }
+    batch.size = 0;
+    return numCollisions;
+}
+
 bool CollisionDetection::_checkCollision(geometry::Edge* e0,
                                          geometry::Edge* e1,
+                                         ContactBuffer& contacts,
                                          float stiffness,
                                          float threshold,
                                          bool setForces)
@@ -416,27 +713,144 @@ bool CollisionDetection::_checkCollision(geometry::Edge* e0,
 
     if (setForces)
     {
-        e0->node0->force += f * (1.0f - t0);
-        e0->node1->force += f * t0;
-        e1->node0->force -= f * (1.0f - t1);
-        e1->node1->force -= f * t1;
+        contacts.add(e0->node0, f * (1.0f - t0));
+        contacts.add(e0->node1, f * t0);
+        contacts.add(e1->node0, -f * (1.0f - t1));
+        contacts.add(e1->node1, -f * t1);
+    }
+    else
+    {
+        contacts.add(e0->node0);
+        contacts.add(e0->node1);
+        contacts.add(e1->node0);
+        contacts.add(e1->node1);
     }
-    e0->node0->collide = true;
-    e0->node1->collide = true;
-    e1->node0->collide = true;
-    e1->node1->collide = true;
     return true;
 }
 
-void CollisionDetection::_checkAndSetForce(geometry::NodePtr node_,
+uint32_t CollisionDetection::_computeContinuousCollision(
+    geometry::HierarchicalAABBPtr aabb0,
+    geometry::HierarchicalAABBPtr aabb1,
+    ContactBuffer& contacts,
+    float tolerance)
+{
+    uint32_t numImpacts = 0;
+    aabb0->collidingPrimitives(
+        aabb1, [&](const geometry::PrimitivePair* pairs, uint32_t size) {
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                auto p0 = pairs[i].first;
+                auto p1 = pairs[i].second;
+                if (p0->type() != p1->type()) continue;
+
+                float time = 1.0f;
+                if (p0->type() == geometry::EDGE)
+                {
+                    time = _timeOfImpact(static_cast<geometry::Edge*>(p0),
+                                         static_cast<geometry::Edge*>(p1),
+                                         tolerance);
+                }
+                else if (p0->type() == geometry::TRIANGLE)
+                {
+                    auto t0 = static_cast<geometry::TrianglePtr>(p0);
+                    auto t1 = static_cast<geometry::TrianglePtr>(p1);
+                    for (auto node : t0->nodes())
+                        time = std::min(time,
+                                        _timeOfImpact(node, t1, tolerance));
+                    for (auto node : t1->nodes())
+                        time = std::min(time,
+                                        _timeOfImpact(node, t0, tolerance));
+                }
+                if (time >= 1.0f) continue;
+
+                ++numImpacts;
+                for (auto node : p0->nodes()) contacts.addImpact(node, time);
+                for (auto node : p1->nodes()) contacts.addImpact(node, time);
+            }
+        });
+    return numImpacts;
+}
+
+float CollisionDetection::_timeOfImpact(geometry::Edge* e0,
+                                        geometry::Edge* e1,
+                                        float tolerance)
+{
+    auto a = e0->node0;
+    auto b = e0->node1;
+    auto c = e1->node0;
+    auto d = e1->node1;
+    float radius =
+        std::max(a->radius, b->radius) + std::max(c->radius, d->radius);
+
+    // Upper bound of the relative displacement of any two points of the
+    // edges along the step
+    float motion =
+        std::max(glm::distance(a->prevPosition, a->position),
+                 glm::distance(b->prevPosition, b->position)) +
+        std::max(glm::distance(c->prevPosition, c->position),
+                 glm::distance(d->prevPosition, d->position));
+    if (motion <= 0.0f) return 1.0f;
+
+    float time = 0.0f;
+    for (uint32_t i = 0; i < COLLISION_DETECTION_MAX_ADVANCEMENTS; ++i)
+    {
+        geometry::Vec3 p0, p1;
+        float t0, t1;
+        geometry::project(geometry::mix(a->prevPosition, a->position, time),
+                          geometry::mix(b->prevPosition, b->position, time),
+                          geometry::mix(c->prevPosition, c->position, time),
+                          geometry::mix(d->prevPosition, d->position, time),
+                          p0, t0, p1, t1);
+        float gap = glm::distance(p0, p1) - radius;
+        if (gap < tolerance) return i == 0 ? 1.0f : time;
+        time += (gap - 0.5f * tolerance) / motion;
+        if (time >= 1.0f) return 1.0f;
+    }
+    return time;
+}
+
+float CollisionDetection::_timeOfImpact(geometry::NodePtr node,
+                                        geometry::TrianglePtr triangle,
+                                        float tolerance)
+{
+    auto a = triangle->node0;
+    auto b = triangle->node1;
+    auto c = triangle->node2;
+    if (node == a || node == b || node == c) return 1.0f;
+
+    float motion =
+        glm::distance(node->prevPosition, node->position) +
+        std::max(glm::distance(a->prevPosition, a->position),
+                 std::max(glm::distance(b->prevPosition, b->position),
+                          glm::distance(c->prevPosition, c->position)));
+    if (motion <= 0.0f) return 1.0f;
+
+    float time = 0.0f;
+    for (uint32_t i = 0; i < COLLISION_DETECTION_MAX_ADVANCEMENTS; ++i)
+    {
+        auto p = geometry::mix(node->prevPosition, node->position, time);
+        auto q = geometry::project(
+            p, geometry::mix(a->prevPosition, a->position, time),
+            geometry::mix(b->prevPosition, b->position, time),
+            geometry::mix(c->prevPosition, c->position, time));
+        float gap = glm::distance(p, q);
+        if (gap < tolerance) return i == 0 ? 1.0f : time;
+        time += (gap - 0.5f * tolerance) / motion;
+        if (time >= 1.0f) return 1.0f;
+    }
+    return time;
+}
+
+void CollisionDetection::_checkAndSetForce(ContactBuffer& contacts,
+                                           geometry::NodePtr node_,
                                            geometry::Vec3 normal_,
                                            float dist_,
                                            float stiffness)
 {
     if (dist_ < 0.0)
-    {
-        node_->force += -dist_ * stiffness * normal_;
-    }
+        contacts.add(node_, -dist_ * stiffness * normal_);
+    else
+        contacts.add(node_);
 }
 
 void CollisionDetection::_mergeBoundingBoxes(
@@ -18,6 +18,9 @@
 #ifndef __PHYANIM_COLLISIONDETECTION__
 #define __PHYANIM_COLLISIONDETECTION__
 
+#include "../geometry/BroadPhase.h"
+#include "BatchKernels.h"
+#include "ContactBuffer.h"
 #include "../geometry/Mesh.h"
 #include "../geometry/Tetrahedron.h"
 #include "../geometry/Triangle.h"
@@ -29,9 +32,11 @@ namespace anim
 class CollisionDetection
 {
 public:
-    static uint32_t computeCollisions(geometry::HierarchicalAABBs& aabbs,
-                                      float stiffness,
-                                      float threshold = 0.1f);
+    static uint32_t computeCollisions(
+        geometry::HierarchicalAABBs& aabbs,
+        float stiffness,
+        float threshold = 0.1f,
+        geometry::BroadPhasePtr broadPhase = nullptr);
 
     static uint32_t computeSelfCollisions(geometry::HierarchicalAABBs& aabbs,
                                           float stiffness,
@@ -45,44 +50,125 @@ public:
                                   float stiffness,
                                   float threshold = 0.1f);
 
+    // Narrow phase over a list of candidate pairs, pairs whose limits do not
+    // collide are skipped
+    static uint32_t computeCollisions(const geometry::PrimitivePairs& pairs,
+                                      float stiffness,
+                                      float threshold = 0.1f);
+
     static void computeCollisions(geometry::HierarchicalAABBs& aabbs,
                                   const geometry::AxisAlignedBoundingBox& aabb);
 
+    // Checks the motion of the nodes from their previous to their current
+    // positions, the trees must have swept limits. Nodes of colliding
+    // capsules and vertex-triangle pairs are moved back to their earliest
+    // time of impact. Returns the number of impacts
+    static uint32_t computeContinuousCollisions(
+        geometry::HierarchicalAABBs& aabbs,
+        float tolerance = 0.01f,
+        geometry::BroadPhasePtr broadPhase = nullptr);
+
     static void computeCollisions(geometry::Meshes& meshes,
                                   const geometry::AxisAlignedBoundingBox& aabb);
 
     static geometry::AxisAlignedBoundingBoxes collisionBoundingBoxes(
         geometry::HierarchicalAABBs& aabbs,
-        float sizeFactor = 1.0);
+        float sizeFactor = 1.0,
+        geometry::BroadPhasePtr broadPhase = nullptr);
 
     static geometry::AxisAlignedBoundingBoxes collisionBoundingBoxes(
         geometry::Meshes& meshes,
         float sizeFactor = 1.0);
 
+    // Evaluates triangle and edge pairs with the batched kernels, false uses
+    // the scalar tests one pair at a time
+    static bool batchKernels;
+
+    // Sums the contact forces of every node in a fixed order, results are
+    // bitwise reproducible for any number of threads
+    static bool deterministicContacts;
+
 protected:
+    static geometry::IndexPairs _collidingPairs(
+        geometry::HierarchicalAABBs& aabbs,
+        geometry::BroadPhasePtr broadPhase);
+
+    // Passing the same tree twice computes its self collisions
+    static uint32_t _computeCollision(geometry::HierarchicalAABBPtr aabb0,
+                                      geometry::HierarchicalAABBPtr aabb1,
+                                      ContactBuffer& contacts,
+                                      float stiffness,
+                                      float threshold);
+
     static uint32_t _computeCollision(geometry::HierarchicalAABBPtr aabb0,
+                                      uint32_t id0,
                                       geometry::HierarchicalAABBPtr aabb1,
+                                      uint32_t id1,
+                                      ContactBuffer& contacts,
                                       float stiffness,
                                       float threshold);
 
+    // Tests the pairs with the batched or scalar kernels, full batches are
+    // evaluated and the caller has to flush the remaining ones
+    static uint32_t _checkCollisions(const geometry::PrimitivePair* pairs,
+                                     uint32_t size,
+                                     TriangleBatch& triangleBatch,
+                                     EdgeBatch& edgeBatch,
+                                     ContactBuffer& contacts,
+                                     float stiffness,
+                                     float threshold,
+                                     bool checkLimits = false);
+
     static bool _checkCollision(geometry::PrimitivePtr p0,
                                 geometry::PrimitivePtr p1,
+                                ContactBuffer& contacts,
                                 float stiffness,
                                 float threshold,
                                 bool setForces = true);
 
     static bool _checkCollision(geometry::TrianglePtr t0,
                                 geometry::TrianglePtr t1,
+                                ContactBuffer& contacts,
                                 float stiffness,
                                 bool setForces = true);
 
+    static uint32_t _checkCollisions(TriangleBatch& batch,
+                                     ContactBuffer& contacts,
+                                     float stiffness,
+                                     bool setForces = true);
+
+    static uint32_t _checkCollisions(EdgeBatch& batch,
+                                     ContactBuffer& contacts,
+                                     float stiffness,
+                                     float threshold,
+                                     bool setForces = true);
+
     static bool _checkCollision(geometry::Edge* e0,
                                 geometry::Edge* e1,
+                                ContactBuffer& contacts,
                                 float stiffness,
                                 float threshold,
                                 bool setForces = true);
 
-    static void _checkAndSetForce(geometry::NodePtr node,
+    static uint32_t _computeContinuousCollision(
+        geometry::HierarchicalAABBPtr aabb0,
+        geometry::HierarchicalAABBPtr aabb1,
+        ContactBuffer& contacts,
+        float tolerance);
+
+    // Fraction of the step after which the primitives get closer than the
+    // tolerance, one if they do not. Pairs already closer at the start of
+    // the step are left to the discrete detection
+    static float _timeOfImpact(geometry::Edge* e0,
+                               geometry::Edge* e1,
+                               float tolerance);
+
+    static float _timeOfImpact(geometry::NodePtr node,
+                               geometry::TrianglePtr triangle,
+                               float tolerance);
+
+    static void _checkAndSetForce(ContactBuffer& contacts,
+                                  geometry::NodePtr node,
                                   geometry::Vec3 normal,
                                   float dist,
                                   float stiffness);
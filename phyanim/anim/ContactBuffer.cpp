@@ -0,0 +1,175 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ContactBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#ifdef PHYANIM_USES_OPENMP
+#include <omp.h>
+#endif
+
+namespace phyanim
+{
+namespace anim
+{
+static uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+ContactBuffer::ContactBuffer(bool deterministic_)
+    : deterministic(deterministic_)
+{
+    uint32_t numThreads = 1;
+#ifdef PHYANIM_USES_OPENMP
+    numThreads = omp_get_max_threads();
+#endif
+    _threads.resize(numThreads);
+}
+
+void ContactBuffer::add(geometry::NodePtr node, const geometry::Vec3& force)
+{
+    _threadContacts().contacts.push_back(Contact{node, force});
+}
+
+void ContactBuffer::add(geometry::NodePtr node)
+{
+    _threadContacts().contacts.push_back(Contact{node, geometry::Vec3()});
+}
+
+void ContactBuffer::addImpact(geometry::NodePtr node, float time)
+{
+    _threadContacts().impacts.push_back(Impact{node, time});
+}
+
+void ContactBuffer::apply()
+{
+    if (deterministic)
+    {
+        _applySorted();
+    }
+    else
+    {
+        for (auto& thread : _threads)
+        {
+            for (auto& contact : thread.contacts)
+            {
+                contact.node->force += contact.force;
+                contact.node->collide = true;
+            }
+        }
+    }
+    _applyImpacts();
+    clear();
+}
+
+void ContactBuffer::clear()
+{
+    for (auto& thread : _threads)
+    {
+        thread.contacts.clear();
+        thread.impacts.clear();
+    }
+}
+
+uint64_t ContactBuffer::size() const
+{
+    uint64_t size = 0;
+    for (auto& thread : _threads) size += thread.contacts.size();
+    return size;
+}
+
+uint64_t ContactBuffer::numImpacts() const
+{
+    uint64_t size = 0;
+    for (auto& thread : _threads) size += thread.impacts.size();
+    return size;
+}
+
+ContactBuffer::ThreadContacts& ContactBuffer::_threadContacts()
+{
+    uint32_t id = 0;
+#ifdef PHYANIM_USES_OPENMP
+    id = omp_get_thread_num();
+#endif
+    return _threads[id];
+}
+
+void ContactBuffer::_applySorted()
+{
+    Contacts contacts;
+    contacts.reserve(size());
+    for (auto& thread : _threads)
+        contacts.insert(contacts.end(), thread.contacts.begin(),
+                        thread.contacts.end());
+
+    // Contacts are grouped by node and each group is sorted by the bits of
+    // its forces, the same set of contacts is always added in the same order
+    std::sort(contacts.begin(), contacts.end(),
+              [](const Contact& c0, const Contact& c1) {
+                  if (c0.node != c1.node) return c0.node < c1.node;
+                  for (uint32_t i = 0; i < 3; ++i)
+                  {
+                      uint32_t b0 = floatBits(c0.force[i]);
+                      uint32_t b1 = floatBits(c1.force[i]);
+                      if (b0 != b1) return b0 < b1;
+                  }
+                  return false;
+              });
+
+    for (auto& contact : contacts)
+    {
+        contact.node->force += contact.force;
+        contact.node->collide = true;
+    }
+}
+
+void ContactBuffer::_applyImpacts()
+{
+    // The minimum does not depend on the order, impacts are deterministic
+    std::unordered_map<geometry::NodePtr, float> times;
+    for (auto& thread : _threads)
+    {
+        for (auto& impact : thread.impacts)
+        {
+            auto it = times.find(impact.node);
+            if (it == times.end())
+                times[impact.node] = impact.time;
+            else
+                it->second = std::min(it->second, impact.time);
+        }
+    }
+
+    for (auto& time : times)
+    {
+        auto node = time.first;
+        if (node->fix || node->isSoma) continue;
+        node->position = geometry::mix(node->prevPosition, node->position,
+                                       time.second);
+        node->velocity = geometry::Vec3();
+        node->collide = true;
+        node->dirty = true;
+    }
+}
+
+}  // namespace anim
+}  // namespace phyanim
@@ -0,0 +1,101 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_CONTACT_BUFFER__
+#define __PHYANIM_CONTACT_BUFFER__
+
+#include <vector>
+
+#include "../geometry/Node.h"
+
+namespace phyanim
+{
+namespace anim
+{
+// Force applied to a node by one collision
+typedef struct Contact
+{
+    geometry::NodePtr node;
+    geometry::Vec3 force;
+} Contact;
+
+typedef std::vector<Contact> Contacts;
+
+// Fraction of its last step a node can move before an impact
+typedef struct Impact
+{
+    geometry::NodePtr node;
+    float time;
+} Impact;
+
+typedef std::vector<Impact> Impacts;
+
+class ContactBuffer;
+
+typedef ContactBuffer* ContactBufferPtr;
+
+// Collects the contacts emitted by the collision detection threads, each
+// thread appends to its own list, and applies them to the nodes once the
+// detection is over. The deterministic mode sums the forces of every node in
+// an order that does not depend on the threads scheduling, so results are
+// bitwise reproducible for any number of threads.
+class ContactBuffer
+{
+public:
+    ContactBuffer(bool deterministic = false);
+
+    // Adds a contact to the calling thread list
+    void add(geometry::NodePtr node, const geometry::Vec3& force);
+
+    // Marks the node as colliding without adding any force
+    void add(geometry::NodePtr node);
+
+    void addImpact(geometry::NodePtr node, float time);
+
+    // Adds the forces to the nodes, moves the impacted nodes back to their
+    // earliest impact, sets their collide and dirty flags and clears the
+    // buffer
+    void apply();
+
+    void clear();
+
+    uint64_t size() const;
+
+    uint64_t numImpacts() const;
+
+    bool deterministic;
+
+private:
+    typedef struct alignas(64) ThreadContacts
+    {
+        Contacts contacts;
+        Impacts impacts;
+    } ThreadContacts;
+
+    ThreadContacts& _threadContacts();
+
+    void _applySorted();
+
+    void _applyImpacts();
+
+    std::vector<ThreadContacts> _threads;
+};
+
+}  // namespace anim
+}  // namespace phyanim
+
+#endif  // __PHYANIM_CONTACT_BUFFER__
@@ -0,0 +1,119 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ContactCache.h"
+
+#include <unordered_set>
+
+#include "../geometry/PrimitiveNodes.h"
+
+namespace phyanim
+{
+namespace anim
+{
+ContactCache::ContactCache(float margin_, uint32_t fullPassInterval_)
+    : margin(margin_)
+    , fullPassInterval(fullPassInterval_)
+    , _numCalls(0)
+    , _numFullPasses(0)
+{
+}
+
+uint32_t ContactCache::computeCollisions(geometry::HierarchicalAABBs& aabbs,
+                                         float stiffness,
+                                         float threshold)
+{
+    if (!_isValid(aabbs)) _fullPass(aabbs);
+    ++_numCalls;
+    return CollisionDetection::computeCollisions(_pairs, stiffness,
+                                                 threshold);
+}
+
+void ContactCache::clear()
+{
+    _pairs.clear();
+    _aabbs.clear();
+    _nodes.clear();
+    _positions.clear();
+    _numCalls = 0;
+}
+
+bool ContactCache::_isValid(const geometry::HierarchicalAABBs& aabbs) const
+{
+    if (_numCalls == 0 || _numCalls >= fullPassInterval) return false;
+    if (aabbs != _aabbs) return false;
+
+    // Limits of two primitives get at most twice the largest displacement
+    // closer
+    float maxDistance = 0.25f * margin * margin;
+    uint32_t size = _nodes.size();
+    bool valid = true;
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for reduction(&& : valid)
+#endif
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        geometry::Vec3 displacement = _nodes[i]->position - _positions[i];
+        valid = valid && glm::dot(displacement, displacement) < maxDistance;
+    }
+    return valid;
+}
+
+void ContactCache::_fullPass(geometry::HierarchicalAABBs& aabbs)
+{
+    geometry::SweepAndPrune sweepAndPrune(margin);
+    auto aabbPairs = sweepAndPrune.collidingPairs(aabbs);
+    uint32_t size = aabbPairs.size();
+    std::vector<geometry::PrimitivePairs> pairsSet(size);
+
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        auto& pairs = pairsSet[i];
+        aabbs[aabbPairs[i].first]->collidingPrimitives(
+            aabbs[aabbPairs[i].second],
+            [&](const geometry::PrimitivePair* batch, uint32_t batchSize) {
+                pairs.insert(pairs.end(), batch, batch + batchSize);
+            },
+            margin);
+    }
+
+    _pairs.clear();
+    for (auto& pairs : pairsSet)
+        _pairs.insert(_pairs.end(), pairs.begin(), pairs.end());
+
+    if (aabbs != _aabbs)
+    {
+        _aabbs = aabbs;
+        std::unordered_set<geometry::NodePtr> nodes;
+        for (auto aabb : aabbs)
+            for (auto primitive : aabb->primitives())
+                for (auto node : primitive->nodes()) nodes.insert(node);
+        _nodes.assign(nodes.begin(), nodes.end());
+    }
+    _positions.resize(_nodes.size());
+    for (uint32_t i = 0; i < _nodes.size(); ++i)
+        _positions[i] = _nodes[i]->position;
+
+    _numCalls = 0;
+    ++_numFullPasses;
+}
+
+}  // namespace anim
+}  // namespace phyanim
@@ -0,0 +1,85 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_CONTACT_CACHE__
+#define __PHYANIM_CONTACT_CACHE__
+
+#include "CollisionDetection.h"
+
+namespace phyanim
+{
+namespace anim
+{
+class ContactCache;
+
+typedef ContactCache* ContactCachePtr;
+
+// Keeps the primitive pairs whose limits are closer than a margin between
+// solver iterations. While no node has moved more than half the margin since
+// the pairs were gathered, every colliding pair is in the cache, so only the
+// cached pairs go through the narrow phase and the broad phase and BVH
+// traversals are skipped. The cache is refreshed after fullPassInterval calls,
+// once a node moves too far or when the set of hierarchies changes. The cache
+// keeps primitive pointers and only compares the hierarchy pointers, so it
+// has to be cleared whenever the primitives of the hierarchies change.
+class ContactCache
+{
+public:
+    ContactCache(float margin = 0.1f, uint32_t fullPassInterval = 10);
+
+    // Same results as CollisionDetection::computeCollisions, the hierarchies
+    // have to be refitted before every call
+    uint32_t computeCollisions(geometry::HierarchicalAABBs& aabbs,
+                               float stiffness,
+                               float threshold = 0.1f);
+
+    // Drops the cached pairs, must be called whenever the primitives of the
+    // hierarchies are added, removed or deleted
+    void clear();
+
+    uint64_t numPairs() const { return _pairs.size(); };
+
+    uint64_t numFullPasses() const { return _numFullPasses; };
+
+    float margin;
+
+    uint32_t fullPassInterval;
+
+protected:
+    bool _isValid(const geometry::HierarchicalAABBs& aabbs) const;
+
+    void _fullPass(geometry::HierarchicalAABBs& aabbs);
+
+    geometry::PrimitivePairs _pairs;
+
+    geometry::HierarchicalAABBs _aabbs;
+
+    // Nodes of the cached hierarchies and their positions at the last full
+    // pass
+    geometry::Nodes _nodes;
+
+    std::vector<geometry::Vec3> _positions;
+
+    uint32_t _numCalls;
+
+    uint64_t _numFullPasses;
+};
+
+}  // namespace anim
+}  // namespace phyanim
+
+#endif  // __PHYANIM_CONTACT_CACHE__
@@ -70,12 +70,12 @@ void ExplicitMassSpringSystem::_step(geometry::Mesh* mesh)
     {
         geometry::Vec3 d = edge->node1->position - edge->node0->position;
         float r = edge->resLength;
-        float l = d.length();
-        geometry::Vec3 v = edge->node1->velocity - edge->node0->velocity;
-        geometry::Vec3 f0 = geometry::Vec3();
-        if (l > THRESHOLD) l = THRESHOLD;
+        float l = glm::length(d);
+        if (l < THRESHOLD || r < THRESHOLD) continue;
 
-        f0 = d * (ks * (l / r - 1.0f) + kd * (glm::dot(v, d) / (l * r))) / l;
+        geometry::Vec3 v = edge->node1->velocity - edge->node0->velocity;
+        geometry::Vec3 f0 =
+            d * (ks * (l / r - 1.0f) + kd * (glm::dot(v, d) / (l * r))) / l;
         edge->node0->force += f0;
         edge->node1->force += -f0;
     }
@@ -83,6 +83,7 @@ void ExplicitMassSpringSystem::_step(geometry::Mesh* mesh)
     for (unsigned int i = 0; i < mesh->nodes.size(); i++)
     {
         auto node = mesh->nodes[i];
+        node->prevPosition = node->position;
         if (!node->fix && !node->isSoma)
         {
             geometry::Vec3 a = node->force / node->mass;
@@ -90,6 +91,7 @@ void ExplicitMassSpringSystem::_step(geometry::Mesh* mesh)
             geometry::Vec3 x = node->position + v * _dt;
             node->velocity = v;
             node->position = x;
+            node->dirty = true;
         }
     }
 }
@@ -18,26 +18,114 @@
 #include "ImplicitFEMSystem.h"
 
 #include <Eigen/Dense>
+#include <cstring>
 #include <iostream>
 
 #include "../geometry/Tetrahedron.h"
 #include "../geometry/Triangle.h"
 
+// Sparse LDLT fill-in of tetrahedral meshes grows quickly past this size
+#define IMPLICIT_FEM_SYSTEM_DIRECT_MAX_NODES 5000
+// Floats of the 10 distinct 3x3 stiffness blocks of a tetrahedron
+#define IMPLICIT_FEM_SYSTEM_BLOCK_SIZE 90
+// Element loops above this number of tetrahedra run in parallel
+#define IMPLICIT_FEM_SYSTEM_TASK_SIZE 1024
+
 namespace phyanim
 {
 namespace anim
 {
+// Greedy colouring in rounds of 64 colours tracked with a bit mask per node.
+// Returns the tetrahedra sorted by colour and the offset of every colour
+static void colorTetrahedra(const geometry::Primitives& tets,
+                            uint64_t numNodes,
+                            geometry::Indices& order,
+                            geometry::Indices& offsets)
+{
+    uint32_t numTets = tets.size();
+    uint32_t uncolored = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> colors(numTets, uncolored);
+    std::vector<uint64_t> masks(numNodes);
+    uint32_t numColors = 0;
+    uint32_t remaining = numTets;
+    for (uint32_t base = 0; remaining > 0; base += 64)
+    {
+        std::fill(masks.begin(), masks.end(), 0);
+        for (uint32_t i = 0; i < numTets; ++i)
+        {
+            if (colors[i] != uncolored) continue;
+            auto tet = static_cast<geometry::TetrahedronPtr>(tets[i]);
+            uint64_t used = masks[tet->node0->id] | masks[tet->node1->id] |
+                            masks[tet->node2->id] | masks[tet->node3->id];
+            if (used == std::numeric_limits<uint64_t>::max()) continue;
+
+            uint32_t color = 0;
+            while (used & (1ull << color)) ++color;
+            uint64_t bit = 1ull << color;
+            masks[tet->node0->id] |= bit;
+            masks[tet->node1->id] |= bit;
+            masks[tet->node2->id] |= bit;
+            masks[tet->node3->id] |= bit;
+            colors[i] = base + color;
+            numColors = std::max(numColors, base + color + 1);
+            --remaining;
+        }
+    }
+
+    offsets.assign(numColors + 1, 0);
+    for (uint32_t i = 0; i < numTets; ++i) ++offsets[colors[i] + 1];
+    for (uint32_t c = 0; c < numColors; ++c) offsets[c + 1] += offsets[c];
+    std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+    order.resize(numTets);
+    for (uint32_t i = 0; i < numTets; ++i) order[next[colors[i]]++] = i;
+}
+
 ImplicitFEMSystem::ImplicitFEMSystem(float dt,
                                      CollisionDetection* collDetector_)
     : AnimSystem(dt)
+    , solverType(geometry::CG_SOLVER)
+    , directSolverMaxNodes(IMPLICIT_FEM_SYSTEM_DIRECT_MAX_NODES)
+    , tolerance(0.0f)
+    , maxIterations(0)
 {
 }
 
 ImplicitFEMSystem::~ImplicitFEMSystem(void) {}
 
+// Frees the data of every backend before preprocessing a mesh again
+static void clearSystem(geometry::MeshPtr mesh)
+{
+    mesh->kMatrix = Eigen::SparseMatrix<float>();
+    mesh->AMatrix = Eigen::SparseMatrix<float>();
+    geometry::AlignedFloats().swap(mesh->tetBlocks);
+    geometry::Indices().swap(mesh->tetNodeIds);
+    geometry::Indices().swap(mesh->tetColorOffsets);
+    geometry::AlignedFloats().swap(mesh->AMatrixDiagonal);
+    mesh->kBlockMatrix.clear();
+    geometry::Indices().swap(mesh->tetOrder);
+    geometry::Indices().swap(mesh->kMatrixScatter);
+    geometry::Indices().swap(mesh->kMatrixDiagonalIds);
+}
+
 void ImplicitFEMSystem::preprocessMesh(geometry::MeshPtr mesh_)
 {
-    _conformKMatrix(mesh_);
+    clearSystem(mesh_);
+    mesh_->AMatrixRequestedSolverType = solverType;
+    for (auto primitive : mesh_->tetrahedra)
+    {
+        if (primitive->type() != geometry::TETRAHEDRON)
+        {
+            std::cerr << "Error: non tetrahedral primitive in tetrahedra"
+                      << std::endl;
+            return;
+        }
+    }
+    if (solverType == geometry::MATRIX_FREE_SOLVER)
+        _conformKBlocks(mesh_);
+    else if (solverType == geometry::BLOCK_CG_SOLVER)
+        _conformKBlockMatrix(mesh_);
+    else
+        _conformKMatrix(mesh_);
 }
 
 void ImplicitFEMSystem::_step(geometry::MeshPtr mesh)
@@ -47,8 +135,8 @@ void ImplicitFEMSystem::_step(geometry::MeshPtr mesh)
     Eigen::VectorXf u(size);
     Eigen::VectorXf mv(size);
     Eigen::VectorXf fext(size);
-    Eigen::VectorXf v_1(size);
-    Eigen::VectorXf b(size);
+    Eigen::VectorXf v0(size);
+    Eigen::VectorXf ku;
 
 #ifdef PHYANIM_USES_OPENMP
 #pragma omp parallel for
@@ -59,10 +147,24 @@ void ImplicitFEMSystem::_step(geometry::MeshPtr mesh)
         _addVec3ToVecX(i, node->position - node->initPosition, u);
         _addVec3ToVecX(i, node->velocity * node->mass, mv);
         _addVec3ToVecX(i, node->force, fext);
+        _addVec3ToVecX(i, node->velocity, v0);
     }
 
-    b = mv - _dt * (mesh->kMatrix * u - fext);
-    v_1 = mesh->AMatrixSolver.solve(b);
+    if (mesh->AMatrixSolverType == geometry::MATRIX_FREE_SOLVER)
+    {
+        ku.setZero(size);
+        _applyK(mesh, u, ku, 1.0f);
+    }
+    else if (mesh->AMatrixSolverType == geometry::BLOCK_CG_SOLVER)
+    {
+        mesh->kBlockMatrix.multiply(u, ku);
+    }
+    else
+    {
+        ku = mesh->kMatrix * u;
+    }
+    Eigen::VectorXf b = mv - _dt * (ku - fext);
+    Eigen::VectorXf v_1 = _solve(mesh, b, v0);
 
 #ifdef PHYANIM_USES_OPENMP
 #pragma omp parallel for
@@ -70,263 +172,635 @@ void ImplicitFEMSystem::_step(geometry::MeshPtr mesh)
     for (uint64_t i = 0; i < size / 3; ++i)
     {
         geometry::Node* node = mesh->nodes[i];
+        node->prevPosition = node->position;
         if (!node->fix)
         {
             geometry::Vec3 v(v_1[i * 3], v_1[i * 3 + 1], v_1[i * 3 + 2]);
             geometry::Vec3 x = node->position + v * _dt;
             node->velocity = v;
             node->position = x;
+            node->dirty = true;
         }
     }
 }
 
 void ImplicitFEMSystem::_conformKMatrix(geometry::MeshPtr mesh)
 {
-    float young = mesh->stiffness;
-    float poisson = mesh->poissonRatio;
-    float D = young / ((1 + poisson) * (1 - 2 * poisson));
-    float D0 = D * (1 - poisson);
-    float D1 = D * poisson;
-    float D2 = D * (1 - 2 * poisson) * 0.5;
-    float dt2 = _dt * _dt;
-    TKs ks;
-    _computeTetsK(mesh->tetrahedra, ks, D0, D1, D2);
-
     geometry::Nodes& nodes = mesh->nodes;
-    uint64_t size = nodes.size() * 3;
+    uint64_t numNodes = nodes.size();
 #ifdef PHYANIM_USES_OPENMP
 #pragma omp parallel for
 #endif
-    for (uint64_t i = 0; i < size / 3; ++i)
+    for (uint64_t i = 0; i < numNodes; ++i)
     {
         nodes[i]->id = i;
     }
 
-    Triplets kTriplets(mesh->tetrahedra.size() * 16 * 9);
-    Triplets aTriplets(kTriplets.size() + nodes.size() * 3);
-    _buildKTriplets(mesh->tetrahedra, ks, dt2, kTriplets, aTriplets);
+    _buildKPattern(mesh);
+    _assembleKMatrix(mesh);
+}
 
-    uint64_t tripletId = kTriplets.size();
-    for (uint64_t i = 0; i < size / 3; ++i)
+void ImplicitFEMSystem::updateMesh(geometry::MeshPtr mesh_)
+{
+    // Only the assembled matrices keep a pattern to refill, the element
+    // blocks and the block matrix are built again
+    if (mesh_->kMatrixScatter.empty() ||
+        solverType != mesh_->AMatrixRequestedSolverType ||
+        solverType == geometry::MATRIX_FREE_SOLVER ||
+        solverType == geometry::BLOCK_CG_SOLVER)
+    {
+        preprocessMesh(mesh_);
+        return;
+    }
+    _assembleKMatrix(mesh_);
+}
+
+void ImplicitFEMSystem::_buildKPattern(geometry::MeshPtr mesh)
+{
+    auto& tets = mesh->tetrahedra;
+    uint64_t numTets = tets.size();
+    uint64_t numNodes = mesh->nodes.size();
+    auto& order = mesh->tetOrder;
+    colorTetrahedra(tets, numNodes, order, mesh->tetColorOffsets);
+
+    auto& nodeIds = mesh->tetNodeIds;
+    nodeIds.resize(numTets * 4);
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+    for (uint64_t i = 0; i < numTets; ++i)
     {
-        _addIdentityValueToTriplets(i, nodes[i]->mass, aTriplets,
-                                    tripletId + i * 3);
+        auto tet = static_cast<geometry::TetrahedronPtr>(tets[order[i]]);
+        nodeIds[i * 4] = tet->node0->id;
+        nodeIds[i * 4 + 1] = tet->node1->id;
+        nodeIds[i * 4 + 2] = tet->node2->id;
+        nodeIds[i * 4 + 3] = tet->node3->id;
     }
 
-    mesh->kMatrix.resize(size, size);
-    mesh->AMatrix.resize(size, size);
-    mesh->kMatrix.resizeNonZeros(kTriplets.size());
-    mesh->AMatrix.resizeNonZeros(aTriplets.size());
-    mesh->kMatrix.setFromTriplets(kTriplets.begin(), kTriplets.end());
-    mesh->AMatrix.setFromTriplets(aTriplets.begin(), aTriplets.end());
+    // Every node block row gives 3 columns of the symmetric scalar matrix,
+    // with 3 consecutive values per block
+    geometry::BlockSparseMatrix blocks;
+    blocks.buildPattern(numNodes, nodeIds, 4);
+    uint64_t size = numNodes * 3;
+    auto& kMatrix = mesh->kMatrix;
+    kMatrix.resize(size, size);
+    kMatrix.resizeNonZeros(blocks.numBlocks() * 9);
+    int* outer = kMatrix.outerIndexPtr();
+    int* inner = kMatrix.innerIndexPtr();
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+    for (uint64_t i = 0; i < numNodes; ++i)
+    {
+        uint32_t begin = blocks.rowOffsets[i];
+        uint32_t count = blocks.rowOffsets[i + 1] - begin;
+        for (uint32_t j = 0; j < 3; ++j)
+        {
+            int offset = begin * 9 + j * count * 3;
+            outer[i * 3 + j] = offset;
+            for (uint32_t k = 0; k < count; ++k)
+                for (uint32_t r = 0; r < 3; ++r)
+                    inner[offset + k * 3 + r] =
+                        blocks.columns[begin + k] * 3 + r;
+        }
+    }
+    outer[size] = blocks.numBlocks() * 9;
+
+    // Blocks (a, a) and then (a, b), (b, a) for a < b, as in _scatterTetK
+    auto blockOffset = [&](uint32_t row, uint32_t column) {
+        uint32_t begin = blocks.rowOffsets[column];
+        return begin * 9 + (blocks.blockId(column, row) - begin) * 3;
+    };
+    auto& scatter = mesh->kMatrixScatter;
+    scatter.resize(numTets * 16);
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+    for (uint64_t i = 0; i < numTets; ++i)
+    {
+        const uint32_t* ids = &nodeIds[i * 4];
+        uint32_t* offsets = &scatter[i * 16];
+        for (uint32_t a = 0; a < 4; ++a)
+            offsets[a] = blockOffset(ids[a], ids[a]);
+        offsets += 4;
+        for (uint32_t a = 0; a < 4; ++a)
+        {
+            for (uint32_t b = a + 1; b < 4; ++b)
+            {
+                offsets[0] = blockOffset(ids[a], ids[b]);
+                offsets[1] = blockOffset(ids[b], ids[a]);
+                offsets += 2;
+            }
+        }
+    }
 
-    kTriplets.clear();
-    aTriplets.clear();
-    mesh->AMatrixSolver.compute(mesh->AMatrix);
+    auto& diagonalIds = mesh->kMatrixDiagonalIds;
+    diagonalIds.resize(numNodes);
+    for (uint64_t i = 0; i < numNodes; ++i) diagonalIds[i] = blockOffset(i, i);
 }
 
-void ImplicitFEMSystem::_buildKTriplets(const geometry::Primitives& tets,
-                                        TKs& ks,
-                                        float dt2,
-                                        Triplets& kTriplets,
-                                        Triplets& aTriplets)
+void ImplicitFEMSystem::_assembleKMatrix(geometry::MeshPtr mesh)
 {
-    for (uint64_t i = 0; i < tets.size(); ++i)
+    auto& tets = mesh->tetrahedra;
+    auto& offsets = mesh->tetColorOffsets;
+    auto& order = mesh->tetOrder;
+    auto& kMatrix = mesh->kMatrix;
+    uint64_t numValues = kMatrix.nonZeros();
+    float* values = kMatrix.valuePtr();
+    const int* outer = kMatrix.outerIndexPtr();
+    std::fill(values, values + numValues, 0.0f);
+
+    auto D = _elasticityMatrix(mesh);
+    uint32_t numColors = offsets.empty() ? 0 : offsets.size() - 1;
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel if (tets.size() > IMPLICIT_FEM_SYSTEM_TASK_SIZE)
+#endif
+    for (uint32_t c = 0; c < numColors; ++c)
+    {
+        // Tetrahedra of the same colour write to different values
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp for
+#endif
+        for (uint32_t i = offsets[c]; i < offsets[c + 1]; ++i)
+        {
+            TK k;
+            _computeTetK(static_cast<geometry::TetrahedronPtr>(tets[order[i]]),
+                         D, k);
+            _scatterTetK(k, &mesh->tetNodeIds[i * 4],
+                         &mesh->kMatrixScatter[i * 16], outer, values);
+        }
+    }
+
+    // A = M + dt^2 * K over the same pattern
+    float dt2 = _dt * _dt;
+    auto& aMatrix = mesh->AMatrix;
+    aMatrix = kMatrix;
+    float* aValues = aMatrix.valuePtr();
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+    for (uint64_t i = 0; i < numValues; ++i) aValues[i] *= dt2;
+
+    geometry::Nodes& nodes = mesh->nodes;
+    auto& diagonalIds = mesh->kMatrixDiagonalIds;
+    for (uint64_t i = 0; i < nodes.size(); ++i)
     {
-        auto tet = dynamic_cast<geometry::TetrahedronPtr>(tets[i]);
-        uint64_t id0 = tet->node0->id;
-        uint64_t id1 = tet->node1->id;
-        uint64_t id2 = tet->node2->id;
-        uint64_t id3 = tet->node3->id;
-
-        uint64_t tripletId = i * 16 * 9;
-
-        // row 0
-        Eigen::Matrix3f k = ks[i].k00;
-        _addMatrixToTriplets(id0, id0, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id0, id0, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k01;
-        _addMatrixToTriplets(id0, id1, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id0, id1, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k02;
-        _addMatrixToTriplets(id0, id2, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id0, id2, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k03;
-        _addMatrixToTriplets(id0, id3, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id0, id3, k, aTriplets, tripletId);
-        // row 1
-        tripletId += 9;
-        k = ks[i].k01.transpose();
-        _addMatrixToTriplets(id1, id0, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id1, id0, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k11;
-        _addMatrixToTriplets(id1, id1, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id1, id1, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k12;
-        _addMatrixToTriplets(id1, id2, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id1, id2, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k13;
-        _addMatrixToTriplets(id1, id3, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id1, id3, k, aTriplets, tripletId);
-        // row 2
-        tripletId += 9;
-        k = ks[i].k02.transpose();
-        _addMatrixToTriplets(id2, id0, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id2, id0, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k12.transpose();
-        _addMatrixToTriplets(id2, id1, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id2, id1, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k22;
-        _addMatrixToTriplets(id2, id2, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id2, id2, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k23;
-        _addMatrixToTriplets(id2, id3, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id2, id3, k, aTriplets, tripletId);
-        // row 3
-        tripletId += 9;
-        k = ks[i].k03.transpose();
-        _addMatrixToTriplets(id3, id0, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id3, id0, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k13.transpose();
-        _addMatrixToTriplets(id3, id1, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id3, id1, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k23.transpose();
-        _addMatrixToTriplets(id3, id2, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id3, id2, k, aTriplets, tripletId);
-        tripletId += 9;
-        k = ks[i].k33;
-        _addMatrixToTriplets(id3, id3, k, kTriplets, tripletId);
-        k *= dt2;
-        _addMatrixToTriplets(id3, id3, k, aTriplets, tripletId);
+        uint32_t stride = outer[i * 3 + 1] - outer[i * 3];
+        for (uint32_t j = 0; j < 3; ++j)
+            aValues[diagonalIds[i] + j * stride + j] += nodes[i]->mass;
     }
+    _computeSolver(mesh);
 }
 
-void ImplicitFEMSystem::_computeTetsK(const geometry::Primitives& tets,
-                                      TKs& ks,
-                                      float D0,
-                                      float D1,
-                                      float D2)
+void ImplicitFEMSystem::_scatterTetK(const TK& k,
+                                     const uint32_t* ids,
+                                     const uint32_t* scatter,
+                                     const int* outer,
+                                     float* values)
 {
-    Eigen::MatrixXf D(6, 6);
-    D << D0, D1, D1, 0.0, 0.0, 0.0, D1, D0, D1, 0.0, 0.0, 0.0, D1, D1, D0, 0.0,
-        0.0, 0.0, 0.0, 0.0, 0.0, D2, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, D2, 0.0, 0.0,
-        0.0, 0.0, 0.0, 0.0, D2;
+    auto add = [&](uint32_t offset, uint32_t column,
+                   const Eigen::Matrix3f& m) {
+        uint32_t stride = outer[column * 3 + 1] - outer[column * 3];
+        for (uint32_t j = 0; j < 3; ++j)
+            for (uint32_t i = 0; i < 3; ++i)
+                values[offset + j * stride + i] += m(i, j);
+    };
+
+    const Eigen::Matrix3f* blocks[10] = {&k.k00, &k.k11, &k.k22, &k.k33,
+                                         &k.k01, &k.k02, &k.k03, &k.k12,
+                                         &k.k13, &k.k23};
+    for (uint32_t a = 0; a < 4; ++a) add(scatter[a], ids[a], *blocks[a]);
+
+    const Eigen::Matrix3f** block = blocks + 4;
+    scatter += 4;
+    for (uint32_t a = 0; a < 4; ++a)
+    {
+        for (uint32_t b = a + 1; b < 4; ++b)
+        {
+            add(scatter[0], ids[b], **block);
+            add(scatter[1], ids[a], (*block)->transpose());
+            scatter += 2;
+            ++block;
+        }
+    }
+}
 
-    ks.resize(tets.size());
+void ImplicitFEMSystem::_conformKBlocks(geometry::MeshPtr mesh)
+{
+    geometry::Nodes& nodes = mesh->nodes;
+    uint64_t numNodes = nodes.size();
+    for (uint64_t i = 0; i < numNodes; ++i) nodes[i]->id = i;
+
+    auto& tets = mesh->tetrahedra;
+    uint64_t numTets = tets.size();
+    geometry::Indices order;
+    colorTetrahedra(tets, numNodes, order, mesh->tetColorOffsets);
+
+    static_assert(sizeof(TK) == IMPLICIT_FEM_SYSTEM_BLOCK_SIZE * sizeof(float),
+                  "TK blocks must be packed");
+    auto D = _elasticityMatrix(mesh);
+    mesh->tetBlocks.resize(numTets * IMPLICIT_FEM_SYSTEM_BLOCK_SIZE);
+    mesh->tetNodeIds.resize(numTets * 4);
 #ifdef PHYANIM_USES_OPENMP
 #pragma omp parallel for
 #endif
-    for (uint64_t i = 0; i < tets.size(); ++i)
+    for (uint64_t i = 0; i < numTets; ++i)
     {
-        auto tet = dynamic_cast<geometry::TetrahedronPtr>(tets[i]);
-
-        Eigen::Vector3f x0(glm::value_ptr(tet->node0->initPosition));
-        Eigen::Vector3f x1(glm::value_ptr(tet->node1->initPosition));
-        Eigen::Vector3f x2(glm::value_ptr(tet->node2->initPosition));
-        Eigen::Vector3f x3(glm::value_ptr(tet->node3->initPosition));
-
-        Eigen::Matrix3f basis;
-        basis << x1 - x0, x2 - x0, x3 - x0;
-        basis = basis.inverse().eval();
-
-        Eigen::Vector3f b1 = basis.row(0);
-        Eigen::Vector3f b2 = basis.row(1);
-        Eigen::Vector3f b3 = basis.row(2);
-        Eigen::Vector3f b0 = -b1 - b2 - b3;
-
-        Eigen::MatrixXf B0(6, 3);
-        B0 << b0[0], 0.0, 0.0, 0.0, b0[1], 0.0, 0.0, 0.0, b0[2], b0[1], b0[0],
-            0.0, 0.0, b0[2], b0[1], b0[2], 0.0, b0[0];
-        Eigen::MatrixXf B0T = B0.transpose();
-
-        Eigen::MatrixXf B1(6, 3);
-        B1 << b1[0], 0.0, 0.0, 0.0, b1[1], 0.0, 0.0, 0.0, b1[2], b1[1], b1[0],
-            0.0, 0.0, b1[2], b1[1], b1[2], 0.0, b1[0];
-        Eigen::MatrixXf B1T = B1.transpose();
-
-        Eigen::MatrixXf B2(6, 3);
-        B2 << b2[0], 0.0, 0.0, 0.0, b2[1], 0.0, 0.0, 0.0, b2[2], b2[1], b2[0],
-            0.0, 0.0, b2[2], b2[1], b2[2], 0.0, b2[0];
-
-        Eigen::MatrixXf B2T = B2.transpose();
-
-        Eigen::MatrixXf B3(6, 3);
-        B3 << b3[0], 0.0, 0.0, 0.0, b3[1], 0.0, 0.0, 0.0, b3[2], b3[1], b3[0],
-            0.0, 0.0, b3[2], b3[1], b3[2], 0.0, b3[0];
-        Eigen::MatrixXf B3T = B3.transpose();
-
-        float volume = tet->initVolume();
-
-        ks[i].k00 = B0T * D * B0 * volume;
-        ks[i].k11 = B1T * D * B1 * volume;
-        ks[i].k22 = B2T * D * B2 * volume;
-        ks[i].k33 = B3T * D * B3 * volume;
-        ks[i].k01 = B0T * D * B1 * volume;
-        ks[i].k02 = B0T * D * B2 * volume;
-        ks[i].k03 = B0T * D * B3 * volume;
-        ks[i].k12 = B1T * D * B2 * volume;
-        ks[i].k13 = B1T * D * B3 * volume;
-        ks[i].k23 = B2T * D * B3 * volume;
+        auto tet = static_cast<geometry::TetrahedronPtr>(tets[order[i]]);
+        TK k;
+        _computeTetK(tet, D, k);
+        std::memcpy(&mesh->tetBlocks[i * IMPLICIT_FEM_SYSTEM_BLOCK_SIZE], &k,
+                    sizeof(TK));
+        uint32_t* ids = &mesh->tetNodeIds[i * 4];
+        ids[0] = tet->node0->id;
+        ids[1] = tet->node1->id;
+        ids[2] = tet->node2->id;
+        ids[3] = tet->node3->id;
     }
+
+    // Diagonal of A for the preconditioner
+    float dt2 = _dt * _dt;
+    auto& diagonal = mesh->AMatrixDiagonal;
+    diagonal.resize(numNodes * 3);
+    for (uint64_t i = 0; i < numNodes; ++i)
+        for (uint64_t j = 0; j < 3; ++j) diagonal[i * 3 + j] = nodes[i]->mass;
+    for (uint64_t i = 0; i < numTets; ++i)
+    {
+        const float* blocks =
+            &mesh->tetBlocks[i * IMPLICIT_FEM_SYSTEM_BLOCK_SIZE];
+        for (uint64_t a = 0; a < 4; ++a)
+        {
+            Eigen::Map<const Eigen::Matrix3f> k(blocks + a * 9);
+            uint64_t id = mesh->tetNodeIds[i * 4 + a] * 3;
+            for (uint64_t j = 0; j < 3; ++j) diagonal[id + j] += dt2 * k(j, j);
+        }
+    }
+
+    mesh->AMatrixSolverType = geometry::MATRIX_FREE_SOLVER;
 }
 
-void ImplicitFEMSystem::_addMatrixToTriplets(uint64_t id0,
-                                             uint64_t id1,
-                                             const Eigen::Matrix3f& m,
-                                             Triplets& triplets,
-                                             uint64_t tripletId)
+void ImplicitFEMSystem::_conformKBlockMatrix(geometry::MeshPtr mesh)
 {
-    id0 *= 3;
-    id1 *= 3;
+    geometry::Nodes& nodes = mesh->nodes;
+    uint64_t numNodes = nodes.size();
+    for (uint64_t i = 0; i < numNodes; ++i) nodes[i]->id = i;
 
-    for (uint64_t i = 0; i < 3; ++i)
+    auto& tets = mesh->tetrahedra;
+    uint64_t numTets = tets.size();
+    TKs ks;
+    _computeTetsK(tets, ks, _elasticityMatrix(mesh));
+    geometry::Indices nodeIds(numTets * 4);
+    for (uint64_t i = 0; i < numTets; ++i)
     {
+        auto tet = static_cast<geometry::TetrahedronPtr>(tets[i]);
+        nodeIds[i * 4] = tet->node0->id;
+        nodeIds[i * 4 + 1] = tet->node1->id;
+        nodeIds[i * 4 + 2] = tet->node2->id;
+        nodeIds[i * 4 + 3] = tet->node3->id;
+    }
+    geometry::Indices order;
+    geometry::Indices colorOffsets;
+    colorTetrahedra(tets, numNodes, order, colorOffsets);
+
+    auto& kMatrix = mesh->kBlockMatrix;
+    kMatrix.buildPattern(numNodes, nodeIds, 4);
+    uint32_t numColors = colorOffsets.size() - 1;
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel if (numTets > IMPLICIT_FEM_SYSTEM_TASK_SIZE)
+#endif
+    for (uint32_t c = 0; c < numColors; ++c)
+    {
+        // Tetrahedra of the same colour write to different rows
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp for
+#endif
+        for (uint32_t i = colorOffsets[c]; i < colorOffsets[c + 1]; ++i)
+        {
+            uint32_t tet = order[i];
+            _addTetBlocks(kMatrix, ks[tet], &nodeIds[tet * 4]);
+        }
+    }
+
+    // Only the diagonal of A = M + dt^2 * K is stored, for the preconditioner
+    float dt2 = _dt * _dt;
+    Eigen::VectorXf diagonal = kMatrix.diagonal();
+    auto& aDiagonal = mesh->AMatrixDiagonal;
+    aDiagonal.resize(numNodes * 3);
+    for (uint64_t i = 0; i < numNodes; ++i)
         for (uint64_t j = 0; j < 3; ++j)
+            aDiagonal[i * 3 + j] = nodes[i]->mass + dt2 * diagonal[i * 3 + j];
+    mesh->AMatrixSolverType = geometry::BLOCK_CG_SOLVER;
+}
+
+void ImplicitFEMSystem::_addTetBlocks(geometry::BlockSparseMatrix& matrix,
+                                      const TK& k,
+                                      const uint32_t* ids)
+{
+    const Eigen::Matrix3f* blocks[10] = {&k.k00, &k.k11, &k.k22, &k.k33,
+                                         &k.k01, &k.k02, &k.k03, &k.k12,
+                                         &k.k13, &k.k23};
+    for (uint32_t a = 0; a < 4; ++a)
+        Eigen::Map<Eigen::Matrix3f>(
+            matrix.block(matrix.blockId(ids[a], ids[a]))) += *blocks[a];
+
+    const Eigen::Matrix3f** block = blocks + 4;
+    for (uint32_t a = 0; a < 4; ++a)
+    {
+        for (uint32_t b = a + 1; b < 4; ++b)
         {
-            triplets[tripletId + (i * 3 + j)] =
-                Triplet(id0 + i, id1 + j, m(i, j));
+            Eigen::Map<Eigen::Matrix3f>(
+                matrix.block(matrix.blockId(ids[a], ids[b]))) += **block;
+            Eigen::Map<Eigen::Matrix3f>(
+                matrix.block(matrix.blockId(ids[b], ids[a]))) +=
+                (*block)->transpose();
+            ++block;
         }
     }
 }
 
-void ImplicitFEMSystem::_addIdentityValueToTriplets(uint64_t id0,
-                                                    float value,
-                                                    Triplets& triplets,
-                                                    uint64_t tripletId)
+void ImplicitFEMSystem::_computeSolver(geometry::MeshPtr mesh)
 {
-    id0 *= 3;
+    auto type = solverType;
+    if (type == geometry::AUTO_SOLVER)
+        type = mesh->nodes.size() <= directSolverMaxNodes
+                   ? geometry::LDLT_SOLVER
+                   : geometry::ICCG_SOLVER;
+    // The element blocks and the block matrix are not built from AMatrix
+    if (type == geometry::MATRIX_FREE_SOLVER ||
+        type == geometry::BLOCK_CG_SOLVER)
+        type = geometry::CG_SOLVER;
+
+    // Fall back to the next cheaper backend if a factorization fails
+    if (type == geometry::LDLT_SOLVER)
+    {
+        mesh->AMatrixLDLTSolver.compute(mesh->AMatrix);
+        if (mesh->AMatrixLDLTSolver.info() != Eigen::Success)
+            type = geometry::ICCG_SOLVER;
+    }
+    if (type == geometry::ICCG_SOLVER)
+    {
+        mesh->AMatrixICCGSolver.compute(mesh->AMatrix);
+        if (mesh->AMatrixICCGSolver.info() != Eigen::Success)
+            type = geometry::CG_SOLVER;
+    }
+    if (type == geometry::CG_SOLVER)
+        mesh->AMatrixSolver.compute(mesh->AMatrix);
+    mesh->AMatrixSolverType = type;
+}
 
-    for (uint64_t i = 0; i < 3; ++i)
+template <typename Solver>
+static Eigen::VectorXf solveIterative(
+    Solver& solver,
+    geometry::MeshPtr mesh,
+    const Eigen::VectorXf& b,
+    const Eigen::Ref<const Eigen::VectorXf>& guess,
+    float tolerance,
+    uint32_t maxIterations)
+{
+    // Both are set on every solve, so a zero restores the Eigen defaults
+    // after a previous non zero value
+    solver.setTolerance(tolerance > 0.0f ? tolerance
+                                         : Eigen::NumTraits<float>::epsilon());
+    solver.setMaxIterations(maxIterations > 0 ? maxIterations
+                                              : 2 * b.size());
+    Eigen::VectorXf x = solver.solveWithGuess(b, guess);
+    mesh->AMatrixSolverIterations = solver.iterations();
+    mesh->AMatrixSolverError = solver.error();
+    return x;
+}
+
+Eigen::VectorXf ImplicitFEMSystem::_solve(
+    geometry::MeshPtr mesh,
+    const Eigen::VectorXf& b,
+    const Eigen::Ref<const Eigen::VectorXf>& guess)
+{
+    switch (mesh->AMatrixSolverType)
+    {
+    case geometry::LDLT_SOLVER:
+        mesh->AMatrixSolverIterations = 0;
+        mesh->AMatrixSolverError = 0.0f;
+        return mesh->AMatrixLDLTSolver.solve(b);
+    case geometry::MATRIX_FREE_SOLVER:
+    {
+        float dt2 = _dt * _dt;
+        auto& nodes = mesh->nodes;
+        auto multiply = [&](const Eigen::VectorXf& p, Eigen::VectorXf& y) {
+            y.resize(p.size());
+            for (uint64_t i = 0; i < (uint64_t)p.size(); ++i)
+                y[i] = nodes[i / 3]->mass * p[i];
+            _applyK(mesh, p, y, dt2);
+        };
+        return _solveCG(mesh, multiply, b, guess);
+    }
+    case geometry::BLOCK_CG_SOLVER:
+    {
+        float dt2 = _dt * _dt;
+        auto& kMatrix = mesh->kBlockMatrix;
+        std::vector<float> masses(mesh->nodes.size());
+        for (uint64_t i = 0; i < masses.size(); ++i)
+            masses[i] = mesh->nodes[i]->mass;
+        auto multiply = [&](const Eigen::VectorXf& p, Eigen::VectorXf& y) {
+            kMatrix.multiply(p, y, dt2, masses.data());
+        };
+        return _solveCG(mesh, multiply, b, guess);
+    }
+    case geometry::ICCG_SOLVER:
+        return solveIterative(mesh->AMatrixICCGSolver, mesh, b, guess,
+                              tolerance, maxIterations);
+    default:
+        return solveIterative(mesh->AMatrixSolver, mesh, b, guess, tolerance,
+                              maxIterations);
+    }
+}
+
+void ImplicitFEMSystem::_applyK(geometry::MeshPtr mesh,
+                                const Eigen::VectorXf& u,
+                                Eigen::VectorXf& y,
+                                float scale)
+{
+    auto& offsets = mesh->tetColorOffsets;
+    if (offsets.empty()) return;
+
+    uint32_t numColors = offsets.size() - 1;
+    const float* blocks = mesh->tetBlocks.data();
+    const uint32_t* nodeIds = mesh->tetNodeIds.data();
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel if (offsets.back() > IMPLICIT_FEM_SYSTEM_TASK_SIZE)
+#endif
+    for (uint32_t c = 0; c < numColors; ++c)
     {
-        triplets[tripletId + i] = Triplet(id0 + i, id0 + i, value);
+        // Tetrahedra of the same colour write to different nodes
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp for
+#endif
+        for (uint32_t i = offsets[c]; i < offsets[c + 1]; ++i)
+        {
+            const float* k = blocks + i * IMPLICIT_FEM_SYSTEM_BLOCK_SIZE;
+            const uint32_t* ids = nodeIds + i * 4;
+            Eigen::Vector3f ut[4];
+            Eigen::Vector3f yt[4];
+            for (uint32_t a = 0; a < 4; ++a)
+            {
+                ut[a] = u.segment<3>(ids[a] * 3);
+                yt[a] = Eigen::Map<const Eigen::Matrix3f>(k + a * 9) * ut[a];
+            }
+
+            // Off diagonal blocks k01, k02, k03, k12, k13 and k23
+            const float* block = k + 36;
+            for (uint32_t a = 0; a < 4; ++a)
+            {
+                for (uint32_t b = a + 1; b < 4; ++b)
+                {
+                    Eigen::Map<const Eigen::Matrix3f> kab(block);
+                    yt[a] += kab * ut[b];
+                    yt[b] += kab.transpose() * ut[a];
+                    block += 9;
+                }
+            }
+            for (uint32_t a = 0; a < 4; ++a)
+                y.segment<3>(ids[a] * 3) += scale * yt[a];
+        }
     }
 }
+
+// Same algorithm as Eigen::ConjugateGradient with a diagonal preconditioner,
+// with A * p computed by multiply
+template <typename Multiply>
+Eigen::VectorXf ImplicitFEMSystem::_solveCG(
+    geometry::MeshPtr mesh,
+    const Multiply& multiply,
+    const Eigen::VectorXf& b,
+    const Eigen::Ref<const Eigen::VectorXf>& guess)
+{
+    uint64_t size = b.size();
+    Eigen::Map<const Eigen::VectorXf> diagonal(mesh->AMatrixDiagonal.data(),
+                                               size);
+
+    mesh->AMatrixSolverIterations = 0;
+    mesh->AMatrixSolverError = 0.0f;
+    float rhsNorm2 = b.squaredNorm();
+    if (rhsNorm2 == 0.0f) return Eigen::VectorXf::Zero(size);
+
+    float tol = tolerance > 0.0f ? tolerance
+                                 : Eigen::NumTraits<float>::epsilon();
+    uint32_t maxIters = maxIterations > 0 ? maxIterations : 2 * size;
+    float threshold = std::max(tol * tol * rhsNorm2,
+                               std::numeric_limits<float>::min());
+
+    Eigen::VectorXf x = guess;
+    Eigen::VectorXf tmp(size);
+    multiply(x, tmp);
+    Eigen::VectorXf residual = b - tmp;
+    float residualNorm2 = residual.squaredNorm();
+    uint32_t i = 0;
+    if (residualNorm2 >= threshold)
+    {
+        Eigen::VectorXf p = residual.cwiseQuotient(diagonal);
+        Eigen::VectorXf z(size);
+        float absNew = residual.dot(p);
+        while (i < maxIters)
+        {
+            multiply(p, tmp);
+            float alpha = absNew / p.dot(tmp);
+            x += alpha * p;
+            residual -= alpha * tmp;
+            residualNorm2 = residual.squaredNorm();
+            ++i;
+            if (residualNorm2 < threshold) break;
+
+            z = residual.cwiseQuotient(diagonal);
+            float absOld = absNew;
+            absNew = residual.dot(z);
+            p = z + (absNew / absOld) * p;
+        }
+    }
+    mesh->AMatrixSolverIterations = i;
+    mesh->AMatrixSolverError = std::sqrt(residualNorm2 / rhsNorm2);
+    return x;
+}
+
+void ImplicitFEMSystem::_computeTetsK(const geometry::Primitives& tets,
+                                      TKs& ks,
+                                      const ElasticityMatrix& D)
+{
+    ks.resize(tets.size());
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for
+#endif
+    for (uint64_t i = 0; i < tets.size(); ++i)
+        _computeTetK(static_cast<geometry::TetrahedronPtr>(tets[i]), D,
+                     ks[i]);
+}
+
+void ImplicitFEMSystem::_computeTetK(geometry::TetrahedronPtr tet,
+                                     const ElasticityMatrix& D,
+                                     TK& k)
+{
+    Eigen::Vector3f x0(glm::value_ptr(tet->node0->initPosition));
+    Eigen::Vector3f x1(glm::value_ptr(tet->node1->initPosition));
+    Eigen::Vector3f x2(glm::value_ptr(tet->node2->initPosition));
+    Eigen::Vector3f x3(glm::value_ptr(tet->node3->initPosition));
+
+    Eigen::Matrix3f basis;
+    basis << x1 - x0, x2 - x0, x3 - x0;
+    basis = basis.inverse().eval();
+
+    Eigen::Vector3f b1 = basis.row(0);
+    Eigen::Vector3f b2 = basis.row(1);
+    Eigen::Vector3f b3 = basis.row(2);
+    Eigen::Vector3f b0 = -b1 - b2 - b3;
+
+    Eigen::Matrix<float, 6, 3> B0;
+    B0 << b0[0], 0.0, 0.0, 0.0, b0[1], 0.0, 0.0, 0.0, b0[2], b0[1], b0[0],
+        0.0, 0.0, b0[2], b0[1], b0[2], 0.0, b0[0];
+    Eigen::Matrix<float, 3, 6> B0T = B0.transpose();
+
+    Eigen::Matrix<float, 6, 3> B1;
+    B1 << b1[0], 0.0, 0.0, 0.0, b1[1], 0.0, 0.0, 0.0, b1[2], b1[1], b1[0],
+        0.0, 0.0, b1[2], b1[1], b1[2], 0.0, b1[0];
+    Eigen::Matrix<float, 3, 6> B1T = B1.transpose();
+
+    Eigen::Matrix<float, 6, 3> B2;
+    B2 << b2[0], 0.0, 0.0, 0.0, b2[1], 0.0, 0.0, 0.0, b2[2], b2[1], b2[0],
+        0.0, 0.0, b2[2], b2[1], b2[2], 0.0, b2[0];
+
+    Eigen::Matrix<float, 3, 6> B2T = B2.transpose();
+
+    Eigen::Matrix<float, 6, 3> B3;
+    B3 << b3[0], 0.0, 0.0, 0.0, b3[1], 0.0, 0.0, 0.0, b3[2], b3[1], b3[0],
+        0.0, 0.0, b3[2], b3[1], b3[2], 0.0, b3[0];
+    Eigen::Matrix<float, 3, 6> B3T = B3.transpose();
+
+    float volume = tet->initVolume();
+
+    k.k00 = B0T * D * B0 * volume;
+    k.k11 = B1T * D * B1 * volume;
+    k.k22 = B2T * D * B2 * volume;
+    k.k33 = B3T * D * B3 * volume;
+    k.k01 = B0T * D * B1 * volume;
+    k.k02 = B0T * D * B2 * volume;
+    k.k03 = B0T * D * B3 * volume;
+    k.k12 = B1T * D * B2 * volume;
+    k.k13 = B1T * D * B3 * volume;
+    k.k23 = B2T * D * B3 * volume;
+}
+
+ElasticityMatrix ImplicitFEMSystem::_elasticityMatrix(geometry::MeshPtr mesh)
+{
+    float young = mesh->stiffness;
+    float poisson = mesh->poissonRatio;
+    float D = young / ((1 + poisson) * (1 - 2 * poisson));
+    float D0 = D * (1 - poisson);
+    float D1 = D * poisson;
+    float D2 = D * (1 - 2 * poisson) * 0.5;
+
+    ElasticityMatrix elasticity;
+    elasticity << D0, D1, D1, 0.0, 0.0, 0.0, D1, D0, D1, 0.0, 0.0, 0.0, D1,
+        D1, D0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, D2, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+        D2, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, D2;
+    return elasticity;
+}
+
 void ImplicitFEMSystem::_addVec3ToVecX(uint64_t id,
                                        const geometry::Vec3& value,
                                        Eigen::VectorXf& vecx)
@@ -24,8 +24,7 @@ namespace phyanim
 {
 namespace anim
 {
-typedef Eigen::Triplet<float> Triplet;
-typedef std::vector<Triplet> Triplets;
+typedef Eigen::Matrix<float, 6, 6> ElasticityMatrix;
 
 class ImplicitFEMSystem : public AnimSystem
 {
@@ -36,6 +35,28 @@ public:
 
     void preprocessMesh(geometry::MeshPtr mesh_);
 
+    // Refills the matrices of a preprocessed mesh after a change of its
+    // stiffness, Poisson ratio or masses, keeping their sparsity pattern.
+    // Meshes preprocessed with another backend, and the matrix free and
+    // block CG ones, are preprocessed again
+    void updateMesh(geometry::MeshPtr mesh_);
+
+    // Backend for the meshes preprocessed afterwards, CG by default.
+    // AUTO_SOLVER factors the meshes up to directSolverMaxNodes with LDLT
+    // once and solves the larger ones with incomplete Cholesky CG.
+    // MATRIX_FREE_SOLVER keeps only the element blocks and runs a diagonal
+    // preconditioned CG over them, BLOCK_CG_SOLVER runs it over 3x3 block
+    // sparse matrices
+    geometry::SolverType solverType;
+
+    uint64_t directSolverMaxNodes;
+
+    // Relative residual and iteration cap of the iterative solvers, which
+    // start from the current velocities. Zero keeps the Eigen defaults
+    float tolerance;
+
+    uint32_t maxIterations;
+
 private:
     typedef struct K
     {
@@ -57,28 +78,51 @@ private:
 
     void _conformKMatrix(geometry::MeshPtr mesh);
 
-    void _buildKTriplets(const geometry::Primitives& tets,
-                         TKs& ks,
-                         float dt2,
-                         Triplets& kTriplets,
-                         Triplets& aTriplets);
+    void _buildKPattern(geometry::MeshPtr mesh);
+
+    void _assembleKMatrix(geometry::MeshPtr mesh);
+
+    void _scatterTetK(const TK& k,
+                      const uint32_t* ids,
+                      const uint32_t* scatter,
+                      const int* outer,
+                      float* values);
+
+    void _conformKBlocks(geometry::MeshPtr mesh);
+
+    void _conformKBlockMatrix(geometry::MeshPtr mesh);
+
+    void _addTetBlocks(geometry::BlockSparseMatrix& matrix,
+                       const TK& k,
+                       const uint32_t* ids);
+
+    void _computeSolver(geometry::MeshPtr mesh);
+
+    // y += scale * K * u, over the tetrahedra of each colour in parallel
+    void _applyK(geometry::MeshPtr mesh,
+                 const Eigen::VectorXf& u,
+                 Eigen::VectorXf& y,
+                 float scale);
+
+    template <typename Multiply>
+    Eigen::VectorXf _solveCG(geometry::MeshPtr mesh,
+                             const Multiply& multiply,
+                             const Eigen::VectorXf& b,
+                             const Eigen::Ref<const Eigen::VectorXf>& guess);
+
+    Eigen::VectorXf _solve(geometry::MeshPtr mesh,
+                           const Eigen::VectorXf& b,
+                           const Eigen::Ref<const Eigen::VectorXf>& guess);
 
     void _computeTetsK(const geometry::Primitives& tets,
                        TKs& ks,
-                       float D0,
-                       float D1,
-                       float D2);
-
-    void _addMatrixToTriplets(uint64_t id0,
-                              uint64_t id1,
-                              const Eigen::Matrix3f& m,
-                              Triplets& triplets,
-                              uint64_t tripletId);
-
-    void _addIdentityValueToTriplets(uint64_t id0,
-                                     float value,
-                                     Triplets& triplets,
-                                     uint64_t tripletId);
+                       const ElasticityMatrix& D);
+
+    void _computeTetK(geometry::TetrahedronPtr tet,
+                      const ElasticityMatrix& D,
+                      TK& k);
+
+    ElasticityMatrix _elasticityMatrix(geometry::MeshPtr mesh);
 
     void _addVec3ToVecX(uint64_t id,
                         const geometry::Vec3& value,
@@ -0,0 +1,112 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#define PHYANIM_ARENA_MAX_CHUNK_SIZE (1 << 24)
+
+namespace phyanim
+{
+namespace geometry
+{
+Arena::Arena(size_t chunkSize)
+    : _chunkSize(std::max(chunkSize, size_t(64)))
+    , _current(nullptr)
+    , _end(nullptr)
+    , _usedBytes(0)
+{
+}
+
+Arena::~Arena()
+{
+    clear();
+    for (auto& chunk : _chunks) std::free(chunk.data);
+    _chunks.clear();
+}
+
+bool Arena::owns(const void* ptr) const
+{
+    auto p = static_cast<const char*>(ptr);
+    for (auto& chunk : _chunks)
+        if (p >= chunk.data && p < chunk.data + chunk.size) return true;
+    return false;
+}
+
+void Arena::clear()
+{
+    for (uint32_t i = 1; i < _chunks.size(); ++i) std::free(_chunks[i].data);
+    if (!_chunks.empty())
+    {
+        _chunks.resize(1);
+        _current = _chunks[0].data;
+        _end = _current + _chunks[0].size;
+    }
+    _usedBytes = 0;
+}
+
+void Arena::swap(Arena& other)
+{
+    std::swap(_chunkSize, other._chunkSize);
+    _chunks.swap(other._chunks);
+    std::swap(_current, other._current);
+    std::swap(_end, other._end);
+    std::swap(_usedBytes, other._usedBytes);
+}
+
+size_t Arena::allocatedBytes() const
+{
+    size_t bytes = 0;
+    for (auto& chunk : _chunks) bytes += chunk.size;
+    return bytes;
+}
+
+void* Arena::_allocate(size_t size, size_t alignment)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(_current);
+    uintptr_t aligned = (address + alignment - 1) & ~(alignment - 1);
+    if (!_current || aligned + size > reinterpret_cast<uintptr_t>(_end))
+    {
+        _addChunk(size + alignment);
+        address = reinterpret_cast<uintptr_t>(_current);
+        aligned = (address + alignment - 1) & ~(alignment - 1);
+    }
+    _current = reinterpret_cast<char*>(aligned + size);
+    _usedBytes += size;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void Arena::_addChunk(size_t minSize)
+{
+    // Chunks double in size to keep their number, and the cost of owns, low
+    size_t size = _chunkSize;
+    if (!_chunks.empty())
+        size = std::min(_chunks.back().size * 2,
+                        std::max(_chunkSize,
+                                 size_t(PHYANIM_ARENA_MAX_CHUNK_SIZE)));
+    size = std::max(size, minSize);
+    auto data = static_cast<char*>(std::malloc(size));
+    if (!data) throw std::bad_alloc();
+    _chunks.push_back({data, size});
+    _current = data;
+    _end = data + size;
+}
+
+}  // namespace geometry
+}  // namespace phyanim
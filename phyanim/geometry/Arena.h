@@ -0,0 +1,96 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_ARENA__
+#define __PHYANIM_ARENA__
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace phyanim
+{
+namespace geometry
+{
+class Arena;
+
+typedef Arena* ArenaPtr;
+
+// Chunked bump allocator. Objects created through an arena are never deleted
+// one by one, their memory is released all at once when the arena is cleared
+// or destroyed. Destructors are not called, so only types that do not own
+// other resources, as nodes and primitives, should be created in it. An arena
+// is not thread safe, use one per mesh or morphology.
+class Arena
+{
+public:
+    Arena(size_t chunkSize = 1 << 16);
+
+    Arena(const Arena&) = delete;
+
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena();
+
+    template <class T, class... Args>
+    T* create(Args&&... args)
+    {
+        void* ptr = _allocate(sizeof(T), alignof(T));
+        return new (ptr) T(std::forward<Args>(args)...);
+    };
+
+    bool owns(const void* ptr) const;
+
+    // Releases every object and frees all the chunks but the first one
+    void clear();
+
+    // Exchanges the chunks, so objects copied into a new arena can replace
+    // the ones of this one
+    void swap(Arena& other);
+
+    size_t allocatedBytes() const;
+
+    size_t usedBytes() const { return _usedBytes; };
+
+private:
+    typedef struct Chunk
+    {
+        char* data;
+        size_t size;
+    } Chunk;
+
+    void* _allocate(size_t size, size_t alignment);
+
+    void _addChunk(size_t minSize);
+
+    size_t _chunkSize;
+
+    std::vector<Chunk> _chunks;
+
+    char* _current;
+
+    char* _end;
+
+    size_t _usedBytes;
+};
+
+}  // namespace geometry
+}  // namespace phyanim
+
+#endif  // __PHYANIM_ARENA__
@@ -20,6 +20,8 @@
 #include <iostream>
 #include <limits>
 
+#include "PrimitiveNodes.h"
+
 namespace phyanim
 {
 namespace geometry
@@ -69,6 +71,12 @@ float AxisAlignedBoundingBox::radius() const
     return glm::distance(_upperLimit, center());
 }
 
+bool AxisAlignedBoundingBox::isEmpty() const
+{
+    return (_lowerLimit.x > _upperLimit.x) || (_lowerLimit.y > _upperLimit.y) ||
+           (_lowerLimit.z > _upperLimit.z);
+}
+
 bool AxisAlignedBoundingBox::isColliding(const Node& node) const
 {
     Vec3 r(node.radius, node.radius, node.radius);
@@ -90,6 +98,12 @@ bool AxisAlignedBoundingBox::isColliding(
     return _isColliding(other.lowerLimit(), other.upperLimit());
 }
 
+bool AxisAlignedBoundingBox::isColliding(const Vec3& lowerLimit,
+                                         const Vec3& upperLimit) const
+{
+    return _isColliding(lowerLimit, upperLimit);
+}
+
 bool AxisAlignedBoundingBox::isInside(const Vec3& pos) const
 {
     return _isInside(pos, pos);
@@ -107,6 +121,12 @@ bool AxisAlignedBoundingBox::isInside(const AxisAlignedBoundingBox& other) const
     return _isInside(other.lowerLimit(), other.upperLimit());
 }
 
+bool AxisAlignedBoundingBox::isInside(const Vec3& lowerLimit,
+                                      const Vec3& upperLimit) const
+{
+    return _isInside(lowerLimit, upperLimit);
+}
+
 void AxisAlignedBoundingBox::unite(const Vec3& lowerLimit,
                                    const Vec3& upperLimit)
 {
@@ -53,13 +53,17 @@ public:
 
     float radius() const;
 
+    bool isEmpty() const;
+
     bool isColliding(const Node& node) const;
     bool isColliding(const Primitive& primitive) const;
     bool isColliding(const AxisAlignedBoundingBox& other) const;
+    bool isColliding(const Vec3& lowerLimit, const Vec3& upperLimit) const;
 
     bool isInside(const Vec3& pos) const;
     bool isInside(const Primitive& primitive) const;
     bool isInside(const AxisAlignedBoundingBox& other) const;
+    bool isInside(const Vec3& lowerLimit, const Vec3& upperLimit) const;
 
     void unite(const Vec3& lowerLimit, const Vec3& upperLimit);
     void unite(const Vec3& pos);
@@ -0,0 +1,131 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BlockSparseMatrix.h"
+
+#include <algorithm>
+
+// Rows above this number are multiplied in parallel
+#define BLOCK_SPARSE_MATRIX_TASK_SIZE 1024
+
+namespace phyanim
+{
+namespace geometry
+{
+BlockSparseMatrix::BlockSparseMatrix() {}
+
+BlockSparseMatrix::~BlockSparseMatrix() { clear(); }
+
+void BlockSparseMatrix::buildPattern(uint32_t numRows,
+                                     const Indices& elementIds,
+                                     uint32_t elementSize)
+{
+    uint32_t numElements = elementIds.size() / elementSize;
+
+    // Counting sort of the columns of every row, duplicates included
+    Indices offsets(numRows + 1, 0);
+    for (uint32_t i = 0; i < numRows; ++i) ++offsets[i + 1];
+    for (auto id : elementIds) offsets[id + 1] += elementSize;
+    for (uint32_t i = 0; i < numRows; ++i) offsets[i + 1] += offsets[i];
+
+    Indices candidates(offsets.back());
+    Indices next(offsets.begin(), offsets.end() - 1);
+    for (uint32_t i = 0; i < numRows; ++i) candidates[next[i]++] = i;
+    for (uint32_t i = 0; i < numElements; ++i)
+    {
+        const uint32_t* ids = &elementIds[i * elementSize];
+        for (uint32_t a = 0; a < elementSize; ++a)
+            for (uint32_t b = 0; b < elementSize; ++b)
+                candidates[next[ids[a]]++] = ids[b];
+    }
+
+    rowOffsets.resize(numRows + 1);
+    rowOffsets[0] = 0;
+    columns.clear();
+    columns.reserve(candidates.size() / 2);
+    for (uint32_t i = 0; i < numRows; ++i)
+    {
+        auto begin = candidates.begin() + offsets[i];
+        auto end = candidates.begin() + offsets[i + 1];
+        std::sort(begin, end);
+        columns.insert(columns.end(), begin, std::unique(begin, end));
+        rowOffsets[i + 1] = columns.size();
+    }
+    columns.shrink_to_fit();
+    values.assign(columns.size() * 9, 0.0f);
+}
+
+void BlockSparseMatrix::setZero()
+{
+    std::fill(values.begin(), values.end(), 0.0f);
+}
+
+void BlockSparseMatrix::clear()
+{
+    Indices().swap(rowOffsets);
+    Indices().swap(columns);
+    AlignedFloats().swap(values);
+}
+
+uint32_t BlockSparseMatrix::blockId(uint32_t row, uint32_t column) const
+{
+    auto begin = columns.begin() + rowOffsets[row];
+    auto end = columns.begin() + rowOffsets[row + 1];
+    return std::lower_bound(begin, end, column) - columns.begin();
+}
+
+void BlockSparseMatrix::multiply(const Eigen::VectorXf& x,
+                                 Eigen::VectorXf& y,
+                                 float scale,
+                                 const float* weights) const
+{
+    uint32_t numRows = rows();
+    y.resize(numRows * 3);
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for if (numRows > BLOCK_SPARSE_MATRIX_TASK_SIZE)
+#endif
+    for (uint32_t i = 0; i < numRows; ++i)
+    {
+        Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+        for (uint32_t j = rowOffsets[i]; j < rowOffsets[i + 1]; ++j)
+            sum += Eigen::Map<const Eigen::Matrix3f>(block(j)) *
+                   x.segment<3>(columns[j] * 3);
+        y.segment<3>(i * 3) = scale * sum;
+        if (weights) y.segment<3>(i * 3) += weights[i] * x.segment<3>(i * 3);
+    }
+}
+
+Eigen::VectorXf BlockSparseMatrix::diagonal() const
+{
+    uint32_t numRows = rows();
+    Eigen::VectorXf result(numRows * 3);
+    for (uint32_t i = 0; i < numRows; ++i)
+    {
+        const float* values = block(blockId(i, i));
+        for (uint32_t j = 0; j < 3; ++j) result[i * 3 + j] = values[j * 4];
+    }
+    return result;
+}
+
+uint64_t BlockSparseMatrix::memory() const
+{
+    return (rowOffsets.capacity() + columns.capacity()) * sizeof(uint32_t) +
+           values.capacity() * sizeof(float);
+}
+
+}  // namespace geometry
+}  // namespace phyanim
@@ -0,0 +1,92 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_BLOCK_SPARSE_MATRIX__
+#define __PHYANIM_BLOCK_SPARSE_MATRIX__
+
+#include <Eigen/Core>
+#include <vector>
+
+namespace phyanim
+{
+namespace geometry
+{
+class BlockSparseMatrix;
+
+typedef std::vector<float, Eigen::aligned_allocator<float>> AlignedFloats;
+
+typedef std::vector<uint32_t> Indices;
+
+typedef BlockSparseMatrix* BlockSparseMatrixPtr;
+
+// Square sparse matrix of 3x3 blocks in compressed row format. Blocks are
+// stored column major, one after the other, in the order of their columns
+class BlockSparseMatrix
+{
+public:
+    BlockSparseMatrix();
+
+    ~BlockSparseMatrix();
+
+    // Pattern with the diagonal blocks plus the blocks coupling every pair
+    // of nodes of an element. Elements are groups of elementSize node ids.
+    // Values are set to zero
+    void buildPattern(uint32_t numRows,
+                      const Indices& elementIds,
+                      uint32_t elementSize);
+
+    void setZero();
+
+    void clear();
+
+    uint32_t rows() const
+    {
+        return rowOffsets.empty() ? 0 : rowOffsets.size() - 1;
+    };
+
+    uint32_t numBlocks() const { return columns.size(); };
+
+    // Index of the block at row and column, which must be in the pattern
+    uint32_t blockId(uint32_t row, uint32_t column) const;
+
+    float* block(uint32_t id) { return &values[id * 9]; };
+
+    const float* block(uint32_t id) const { return &values[id * 9]; };
+
+    // y = scale * A * x, plus weights[i] times the three entries of x of
+    // block row i when given. Applies M + dt^2 * K from K and the masses
+    void multiply(const Eigen::VectorXf& x,
+                  Eigen::VectorXf& y,
+                  float scale = 1.0f,
+                  const float* weights = nullptr) const;
+
+    Eigen::VectorXf diagonal() const;
+
+    // Bytes used by the pattern and the values
+    uint64_t memory() const;
+
+    Indices rowOffsets;
+
+    Indices columns;
+
+    AlignedFloats values;
+};
+
+}  // namespace geometry
+}  // namespace phyanim
+
+#endif  // __PHYANIM_BLOCK_SPARSE_MATRIX__
@@ -0,0 +1,532 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BroadPhase.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace phyanim
+{
+namespace geometry
+{
+#define GRID_BITS 21
+#define GRID_MAX_CELLS ((1u << GRID_BITS) - 1)
+#define GRID_MAX_BOX_CELLS 64
+
+SweepAndPrune::SweepAndPrune(float margin) : margin(margin) {}
+
+IndexPairs SweepAndPrune::collidingPairs(const HierarchicalAABBs& aabbs)
+{
+    IndexPairs pairs;
+    std::vector<uint32_t> ids;
+    ids.reserve(aabbs.size());
+
+    AxisAlignedBoundingBox scene;
+    for (uint32_t i = 0; i < aabbs.size(); ++i)
+    {
+        if (aabbs[i]->isEmpty()) continue;
+        scene.unite(aabbs[i]->center());
+        ids.push_back(i);
+    }
+    if (ids.size() < 2) return pairs;
+
+    Vec3 axis = scene.upperLimit() - scene.lowerLimit();
+    uint8_t sortCoord = 0;
+    if (axis.y > axis[sortCoord]) sortCoord = 1;
+    if (axis.z > axis[sortCoord]) sortCoord = 2;
+
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) {
+        return aabbs[a]->lowerLimit()[sortCoord] <
+               aabbs[b]->lowerLimit()[sortCoord];
+    });
+
+    for (uint32_t i = 0; i < ids.size(); ++i)
+    {
+        auto aabb0 = aabbs[ids[i]];
+        float upper = aabb0->upperLimit()[sortCoord] + margin;
+        for (uint32_t j = i + 1; j < ids.size(); ++j)
+        {
+            auto aabb1 = aabbs[ids[j]];
+            if (aabb1->lowerLimit()[sortCoord] > upper) break;
+            if (aabb0->isColliding(aabb1->lowerLimit() - margin,
+                                   aabb1->upperLimit() + margin))
+                pairs.push_back(std::make_pair(std::min(ids[i], ids[j]),
+                                               std::max(ids[i], ids[j])));
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+static IndexPairs toIndexPairs(const std::unordered_set<uint64_t>& keys)
+{
+    IndexPairs pairs;
+    pairs.reserve(keys.size());
+    for (auto key : keys) pairs.push_back(std::make_pair(key >> 32, key));
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+static uint64_t pairKey(uint32_t id0, uint32_t id1)
+{
+    if (id0 > id1) std::swap(id0, id1);
+    return ((uint64_t)id0 << 32) | id1;
+}
+
+IndexPairs IncrementalSweepAndPrune::collidingPairs(
+    const HierarchicalAABBs& aabbs)
+{
+    _added.clear();
+    _removed.clear();
+
+    if (aabbs != _aabbs)
+        _rebuild(aabbs);
+    else
+        for (uint8_t c = 0; c < 3; ++c) _sort(aabbs, c);
+
+    _addedPairs = toIndexPairs(_added);
+    _removedPairs = toIndexPairs(_removed);
+    return toIndexPairs(_pairs);
+}
+
+const IndexPairs& IncrementalSweepAndPrune::addedPairs() const
+{
+    return _addedPairs;
+}
+
+const IndexPairs& IncrementalSweepAndPrune::removedPairs() const
+{
+    return _removedPairs;
+}
+
+void IncrementalSweepAndPrune::clear()
+{
+    _aabbs.clear();
+    for (uint8_t c = 0; c < 3; ++c) _endpoints[c].clear();
+    _pairs.clear();
+    _added.clear();
+    _removed.clear();
+    _addedPairs.clear();
+    _removedPairs.clear();
+}
+
+void IncrementalSweepAndPrune::_rebuild(const HierarchicalAABBs& aabbs)
+{
+    auto prevPairs = _pairs;
+    _aabbs = aabbs;
+    _pairs.clear();
+
+    uint32_t size = aabbs.size();
+    for (uint8_t c = 0; c < 3; ++c)
+    {
+        auto& endpoints = _endpoints[c];
+        endpoints.resize(size * 2);
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            endpoints[i * 2] = {aabbs[i]->lowerLimit()[c], i, true};
+            endpoints[i * 2 + 1] = {aabbs[i]->upperLimit()[c], i, false};
+        }
+        std::sort(endpoints.begin(), endpoints.end(),
+                  [](const Endpoint& a, const Endpoint& b) {
+                      if (a.value == b.value) return a.lower && !b.lower;
+                      return a.value < b.value;
+                  });
+    }
+
+    SweepAndPrune sweepAndPrune;
+    for (auto pair : sweepAndPrune.collidingPairs(aabbs))
+        _pairs.insert(pairKey(pair.first, pair.second));
+
+    for (auto key : _pairs)
+        if (prevPairs.find(key) == prevPairs.end()) _added.insert(key);
+    for (auto key : prevPairs)
+        if (_pairs.find(key) == _pairs.end()) _removed.insert(key);
+}
+
+void IncrementalSweepAndPrune::_sort(const HierarchicalAABBs& aabbs,
+                                     uint8_t coord)
+{
+    auto& endpoints = _endpoints[coord];
+    uint32_t size = endpoints.size();
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        auto& endpoint = endpoints[i];
+        auto aabb = aabbs[endpoint.id];
+        endpoint.value = endpoint.lower ? aabb->lowerLimit()[coord]
+                                        : aabb->upperLimit()[coord];
+    }
+
+    for (uint32_t i = 1; i < size; ++i)
+    {
+        Endpoint endpoint = endpoints[i];
+        uint32_t j = i;
+        while (j > 0)
+        {
+            auto& prev = endpoints[j - 1];
+            if (prev.value < endpoint.value) break;
+            if (prev.value == endpoint.value && (prev.lower || !endpoint.lower))
+                break;
+
+            // A lower limit passing an upper limit starts an overlap on this
+            // axis and an upper limit passing a lower limit ends it
+            if (endpoint.lower && !prev.lower)
+            {
+                if (aabbs[endpoint.id]->isColliding(*aabbs[prev.id]))
+                    _addPair(endpoint.id, prev.id);
+            }
+            else if (!endpoint.lower && prev.lower)
+            {
+                _removePair(endpoint.id, prev.id);
+            }
+            endpoints[j] = prev;
+            --j;
+        }
+        endpoints[j] = endpoint;
+    }
+}
+
+void IncrementalSweepAndPrune::_addPair(uint32_t id0, uint32_t id1)
+{
+    if (id0 == id1) return;
+    uint64_t key = pairKey(id0, id1);
+    if (!_pairs.insert(key).second) return;
+    if (_removed.erase(key) == 0) _added.insert(key);
+}
+
+void IncrementalSweepAndPrune::_removePair(uint32_t id0, uint32_t id1)
+{
+    uint64_t key = pairKey(id0, id1);
+    if (_pairs.erase(key) == 0) return;
+    if (_added.erase(key) == 0) _removed.insert(key);
+}
+
+UniformGrid::UniformGrid(float cellSize) : cellSize(cellSize) {}
+
+IndexPairs UniformGrid::collidingPairs(const HierarchicalAABBs& aabbs)
+{
+    IndexPairs pairs;
+    std::vector<uint32_t> ids;
+    ids.reserve(aabbs.size());
+
+    AxisAlignedBoundingBox scene;
+    std::vector<float> extents;
+    extents.reserve(aabbs.size());
+    for (uint32_t i = 0; i < aabbs.size(); ++i)
+    {
+        if (aabbs[i]->isEmpty()) continue;
+        scene.unite(*aabbs[i]);
+        Vec3 axis = aabbs[i]->upperLimit() - aabbs[i]->lowerLimit();
+        extents.push_back(std::max(axis.x, std::max(axis.y, axis.z)));
+        ids.push_back(i);
+    }
+    if (ids.size() < 2) return pairs;
+
+    // The median keeps a few huge boxes from coarsening the whole grid
+    float size = cellSize;
+    if (size <= 0.0f)
+    {
+        auto median = extents.begin() + extents.size() / 2;
+        std::nth_element(extents.begin(), median, extents.end());
+        size = *median;
+    }
+    Vec3 sceneAxis = scene.upperLimit() - scene.lowerLimit();
+    float sceneExtent =
+        std::max(sceneAxis.x, std::max(sceneAxis.y, sceneAxis.z));
+    size = std::max(size, sceneExtent / GRID_MAX_CELLS);
+    if (size <= 0.0f) size = 1.0f;
+
+    Vec3 origin = scene.lowerLimit();
+    auto cellCoords = [&](const Vec3& pos, uint32_t* coords) {
+        for (uint8_t c = 0; c < 3; ++c)
+        {
+            float cell = std::floor((pos[c] - origin[c]) / size);
+            coords[c] = std::min((uint32_t)std::max(cell, 0.0f),
+                                 (uint32_t)GRID_MAX_CELLS);
+        }
+    };
+
+    // Boxes covering more than GRID_MAX_BOX_CELLS cells are not inserted
+    // and are tested against every other box instead
+    std::vector<uint32_t> lowerCells(ids.size() * 3);
+    std::vector<uint32_t> upperCells(ids.size() * 3);
+    std::vector<uint32_t> oversized;
+    std::vector<bool> isOversized(ids.size(), false);
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    for (uint32_t i = 0; i < ids.size(); ++i)
+    {
+        uint32_t* lower = &lowerCells[i * 3];
+        uint32_t* upper = &upperCells[i * 3];
+        cellCoords(aabbs[ids[i]]->lowerLimit(), lower);
+        cellCoords(aabbs[ids[i]]->upperLimit(), upper);
+        uint64_t numCells = 1;
+        for (uint8_t c = 0; c < 3; ++c) numCells *= upper[c] - lower[c] + 1;
+        if (numCells > GRID_MAX_BOX_CELLS)
+        {
+            oversized.push_back(i);
+            isOversized[i] = true;
+            continue;
+        }
+        for (uint64_t x = lower[0]; x <= upper[0]; ++x)
+            for (uint64_t y = lower[1]; y <= upper[1]; ++y)
+                for (uint64_t z = lower[2]; z <= upper[2]; ++z)
+                    cells[(x << (2 * GRID_BITS)) | (y << GRID_BITS) | z]
+                        .push_back(i);
+    }
+
+    auto addPair = [&](uint32_t id0, uint32_t id1) {
+        pairs.push_back(std::make_pair(std::min(ids[id0], ids[id1]),
+                                       std::max(ids[id0], ids[id1])));
+    };
+
+    for (auto& cell : cells)
+    {
+        auto& cellIds = cell.second;
+        uint64_t key = cell.first;
+        for (uint32_t i = 0; i < cellIds.size(); ++i)
+        {
+            uint32_t id0 = cellIds[i];
+            for (uint32_t j = i + 1; j < cellIds.size(); ++j)
+            {
+                uint32_t id1 = cellIds[j];
+                if (!aabbs[ids[id0]]->isColliding(*aabbs[ids[id1]])) continue;
+
+                // Only the first cell shared by both boxes reports the pair
+                uint64_t first[3];
+                for (uint8_t c = 0; c < 3; ++c)
+                    first[c] = std::max(lowerCells[id0 * 3 + c],
+                                        lowerCells[id1 * 3 + c]);
+                if (((first[0] << (2 * GRID_BITS)) | (first[1] << GRID_BITS) |
+                     first[2]) != key)
+                    continue;
+
+                addPair(id0, id1);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < oversized.size(); ++i)
+    {
+        uint32_t id0 = oversized[i];
+        for (uint32_t id1 = 0; id1 < ids.size(); ++id1)
+        {
+            // Pairs of oversized boxes are reported by the first one
+            if (id1 == id0 || (isOversized[id1] && id1 < id0)) continue;
+            if (aabbs[ids[id0]]->isColliding(*aabbs[ids[id1]]))
+                addPair(id0, id1);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+static float boxArea(const HierarchicalAABBNode& node)
+{
+    Vec3 axis = node.upperLimit - node.lowerLimit;
+    if (axis.x < 0.0f || axis.y < 0.0f || axis.z < 0.0f) return 0.0f;
+    return 2.0f * (axis.x * axis.y + axis.y * axis.z + axis.z * axis.x);
+}
+
+SceneHierarchicalAABB::SceneHierarchicalAABB()
+    : rebuildThreshold(2.0f)
+    , _builtCost(0.0f)
+{
+}
+
+IndexPairs SceneHierarchicalAABB::collidingPairs(
+    const HierarchicalAABBs& aabbs)
+{
+    IndexPairs pairs;
+    update(aabbs);
+    if (!_nodes.empty()) _collidingPairs(0, pairs);
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+void SceneHierarchicalAABB::update(const HierarchicalAABBs& aabbs)
+{
+    if (aabbs != _aabbs)
+    {
+        _aabbs = aabbs;
+        _build();
+        return;
+    }
+    if (_nodes.empty()) return;
+
+    float cost = _refit();
+    if (rebuildThreshold > 0.0f && _builtCost > 0.0f &&
+        cost > rebuildThreshold * _builtCost)
+        _build();
+}
+
+std::vector<uint32_t> SceneHierarchicalAABB::collidingIds(
+    const AxisAlignedBoundingBox& axisAlignedBoundingBox) const
+{
+    std::vector<uint32_t> ids;
+    if (!_nodes.empty()) _collidingIds(0, axisAlignedBoundingBox, ids);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void SceneHierarchicalAABB::clear()
+{
+    _aabbs.clear();
+    _nodes.clear();
+    _ids.clear();
+    _centers.clear();
+    _builtCost = 0.0f;
+}
+
+uint32_t SceneHierarchicalAABB::numNodes() const { return _nodes.size(); }
+
+void SceneHierarchicalAABB::_build()
+{
+    uint32_t size = _aabbs.size();
+    _nodes.clear();
+    _ids.resize(size);
+    _centers.resize(size);
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        _ids[i] = i;
+        _centers[i] = _aabbs[i]->isEmpty() ? Vec3() : _aabbs[i]->center();
+    }
+    _builtCost = 0.0f;
+    if (size == 0) return;
+
+    _nodes.reserve(2 * size - 1);
+    _divide(0, size);
+    _builtCost = _refit();
+}
+
+// Median split along the longest axis of the centers
+uint32_t SceneHierarchicalAABB::_divide(uint32_t begin, uint32_t end)
+{
+    uint32_t id = _nodes.size();
+    _nodes.push_back(HierarchicalAABBNode());
+    if (end - begin == 1)
+    {
+        _nodes[id].offset = begin;
+        _nodes[id].size = 1;
+        return id;
+    }
+
+    AxisAlignedBoundingBox centers;
+    for (uint32_t i = begin; i < end; ++i) centers.unite(_centers[_ids[i]]);
+    Vec3 axis = centers.upperLimit() - centers.lowerLimit();
+    uint8_t coord = 0;
+    if (axis.y > axis[coord]) coord = 1;
+    if (axis.z > axis[coord]) coord = 2;
+
+    uint32_t middle = (begin + end) / 2;
+    std::nth_element(_ids.begin() + begin, _ids.begin() + middle,
+                     _ids.begin() + end, [&](uint32_t a, uint32_t b) {
+                         return _centers[a][coord] < _centers[b][coord];
+                     });
+    _divide(begin, middle);
+    uint32_t child1 = _divide(middle, end);
+    _nodes[id].offset = child1;
+    _nodes[id].size = 0;
+    return id;
+}
+
+// Children follow their parents, so a reverse pass refits bottom up
+float SceneHierarchicalAABB::_refit()
+{
+    float cost = 0.0f;
+    for (uint32_t i = _nodes.size(); i-- > 0;)
+    {
+        auto& node = _nodes[i];
+        if (node.isLeaf())
+        {
+            auto aabb = _aabbs[_ids[node.offset]];
+            node.lowerLimit = aabb->lowerLimit();
+            node.upperLimit = aabb->upperLimit();
+        }
+        else
+        {
+            auto& child0 = _nodes[i + 1];
+            auto& child1 = _nodes[node.offset];
+            node.lowerLimit = glm::min(child0.lowerLimit, child1.lowerLimit);
+            node.upperLimit = glm::max(child0.upperLimit, child1.upperLimit);
+        }
+        cost += boxArea(node);
+    }
+    float rootArea = boxArea(_nodes[0]);
+    return rootArea > 0.0f ? cost / rootArea : 0.0f;
+}
+
+void SceneHierarchicalAABB::_collidingPairs(uint32_t id,
+                                            IndexPairs& pairs) const
+{
+    auto& node = _nodes[id];
+    if (node.isLeaf()) return;
+    _collidingPairs(id + 1, pairs);
+    _collidingPairs(node.offset, pairs);
+    _collidingPairs(id + 1, node.offset, pairs);
+}
+
+void SceneHierarchicalAABB::_collidingPairs(uint32_t id0,
+                                            uint32_t id1,
+                                            IndexPairs& pairs) const
+{
+    auto& node0 = _nodes[id0];
+    auto& node1 = _nodes[id1];
+    if (!node0.isColliding(node1)) return;
+
+    if (!node0.isLeaf() && !node1.isLeaf())
+    {
+        _collidingPairs(id0 + 1, id1 + 1, pairs);
+        _collidingPairs(id0 + 1, node1.offset, pairs);
+        _collidingPairs(node0.offset, id1 + 1, pairs);
+        _collidingPairs(node0.offset, node1.offset, pairs);
+    }
+    else if (!node0.isLeaf())
+    {
+        _collidingPairs(id0 + 1, id1, pairs);
+        _collidingPairs(node0.offset, id1, pairs);
+    }
+    else if (!node1.isLeaf())
+    {
+        _collidingPairs(id0, id1 + 1, pairs);
+        _collidingPairs(id0, node1.offset, pairs);
+    }
+    else
+    {
+        uint32_t aabb0 = _ids[node0.offset];
+        uint32_t aabb1 = _ids[node1.offset];
+        pairs.push_back(
+            std::make_pair(std::min(aabb0, aabb1), std::max(aabb0, aabb1)));
+    }
+}
+
+void SceneHierarchicalAABB::_collidingIds(uint32_t id,
+                                          const AxisAlignedBoundingBox& aabb,
+                                          std::vector<uint32_t>& ids) const
+{
+    auto& node = _nodes[id];
+    if (!aabb.isColliding(node.lowerLimit, node.upperLimit)) return;
+    if (node.isLeaf())
+    {
+        ids.push_back(_ids[node.offset]);
+        return;
+    }
+    _collidingIds(id + 1, aabb, ids);
+    _collidingIds(node.offset, aabb, ids);
+}
+
+}  // namespace geometry
+}  // namespace phyanim
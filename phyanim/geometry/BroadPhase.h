@@ -0,0 +1,175 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_BROAD_PHASE__
+#define __PHYANIM_BROAD_PHASE__
+
+#include <unordered_set>
+
+#include "HierarchicalAABB.h"
+
+namespace phyanim
+{
+namespace geometry
+{
+class BroadPhase;
+
+typedef BroadPhase* BroadPhasePtr;
+
+class BroadPhase
+{
+public:
+    virtual ~BroadPhase(){};
+
+    // Sorted index pairs (i < j) of the overlapping top level boxes
+    virtual IndexPairs collidingPairs(const HierarchicalAABBs& aabbs) = 0;
+};
+
+class SweepAndPrune : public BroadPhase
+{
+public:
+    SweepAndPrune(float margin = 0.0f);
+
+    virtual ~SweepAndPrune(){};
+
+    IndexPairs collidingPairs(const HierarchicalAABBs& aabbs);
+
+    // Boxes closer than the margin are also reported
+    float margin;
+};
+
+class IncrementalSweepAndPrune : public BroadPhase
+{
+public:
+    IncrementalSweepAndPrune(){};
+
+    virtual ~IncrementalSweepAndPrune(){};
+
+    // Sorted endpoints are kept between calls and repaired with insertion
+    // sort, so the hierarchies have to be updated before every call
+    IndexPairs collidingPairs(const HierarchicalAABBs& aabbs);
+
+    const IndexPairs& addedPairs() const;
+
+    const IndexPairs& removedPairs() const;
+
+    void clear();
+
+protected:
+    typedef struct Endpoint
+    {
+        float value;
+        uint32_t id;
+        bool lower;
+    } Endpoint;
+
+    typedef std::vector<Endpoint> Endpoints;
+
+    void _rebuild(const HierarchicalAABBs& aabbs);
+
+    void _sort(const HierarchicalAABBs& aabbs, uint8_t coord);
+
+    void _addPair(uint32_t id0, uint32_t id1);
+
+    void _removePair(uint32_t id0, uint32_t id1);
+
+    HierarchicalAABBs _aabbs;
+
+    Endpoints _endpoints[3];
+
+    std::unordered_set<uint64_t> _pairs;
+
+    std::unordered_set<uint64_t> _added;
+
+    std::unordered_set<uint64_t> _removed;
+
+    IndexPairs _addedPairs;
+
+    IndexPairs _removedPairs;
+};
+
+class UniformGrid : public BroadPhase
+{
+public:
+    // A zero cell size uses the median extent of the boxes on every call
+    UniformGrid(float cellSize = 0.0f);
+
+    virtual ~UniformGrid(){};
+
+    IndexPairs collidingPairs(const HierarchicalAABBs& aabbs);
+
+    float cellSize;
+};
+
+// Top level tree whose leaves are the hierarchies. It is refitted on every
+// call while the hierarchies are the same and rebuilt when they change
+class SceneHierarchicalAABB : public BroadPhase
+{
+public:
+    SceneHierarchicalAABB();
+
+    virtual ~SceneHierarchicalAABB(){};
+
+    IndexPairs collidingPairs(const HierarchicalAABBs& aabbs);
+
+    // Refits the tree to the current limits of the hierarchies
+    void update(const HierarchicalAABBs& aabbs);
+
+    // Sorted indices of the hierarchies colliding with the box, as of the
+    // last update. Pays off for repeated queries over the same hierarchies,
+    // a single box is tested as fast against the limits of each one
+    std::vector<uint32_t> collidingIds(
+        const AxisAlignedBoundingBox& axisAlignedBoundingBox) const;
+
+    void clear();
+
+    uint32_t numNodes() const;
+
+    // Rebuild when the SAH cost grows by this ratio, zero disables it
+    float rebuildThreshold;
+
+protected:
+    void _build();
+
+    uint32_t _divide(uint32_t begin, uint32_t end);
+
+    float _refit();
+
+    void _collidingPairs(uint32_t id, IndexPairs& pairs) const;
+
+    void _collidingPairs(uint32_t id0, uint32_t id1, IndexPairs& pairs) const;
+
+    void _collidingIds(uint32_t id,
+                       const AxisAlignedBoundingBox& aabb,
+                       std::vector<uint32_t>& ids) const;
+
+    HierarchicalAABBs _aabbs;
+
+    // Nodes stored in depth first order, leaves reference one hierarchy
+    HierarchicalAABBNodes _nodes;
+
+    std::vector<uint32_t> _ids;
+
+    std::vector<Vec3> _centers;
+
+    float _builtCost;
+};
+
+}  // namespace geometry
+}  // namespace phyanim
+
+#endif  // __PHYANIM_BROAD_PHASE__
@@ -17,11 +17,16 @@
 
 #include "Edge.h"
 
+#include "PrimitiveNodes.h"
+
 namespace phyanim
 {
 namespace geometry
 {
-Edge::Edge(Node* node0_, Node* node1_) : node0(node0_), node1(node1_)
+Edge::Edge(Node* node0_, Node* node1_)
+    : Primitive(EDGE)
+    , node0(node0_)
+    , node1(node1_)
 {
     update();
     resLength = glm::distance(node1->position, node0->position);
@@ -91,7 +96,7 @@ Nodes uniqueNodes(Edges& edges)
     return Nodes(uNodes.begin(), uNodes.end());
 }
 
-void resample(Edges& edges)
+void resample(Edges& edges, Arena& arena)
 {
     Edges newEdges;
     for (auto edge : edges)
@@ -114,12 +119,12 @@ void resample(Edges& edges)
                 float t = tInc * i;
                 Vec3 pos(pos0 * (1.0f - t) + pos1 * t);
                 float r = r0 * (1.0 - t) + r1 * t;
-                auto node = new Node(pos, 0, r, Vec3(), Vec3(), r);
-                newEdges.push_back(new Edge(prevNode, node));
+                auto node =
+                    arena.create<Node>(pos, 0, r, Vec3(), Vec3(), r);
+                newEdges.push_back(arena.create<Edge>(prevNode, node));
                 prevNode = node;
             }
-            newEdges.push_back(new Edge(prevNode, edge->node1));
-            delete edge;
+            newEdges.push_back(arena.create<Edge>(prevNode, edge->node1));
         }
         else
         {
@@ -130,7 +135,7 @@ void resample(Edges& edges)
     edges.insert(edges.end(), newEdges.begin(), newEdges.end());
 }
 
-void resample(Edges& edges, float len)
+void resample(Edges& edges, float len, Arena& arena)
 {
     Edges newEdges;
     for (auto edge : edges)
@@ -153,12 +158,12 @@ void resample(Edges& edges, float len)
                 float t = tInc * i;
                 Vec3 pos(pos0 * (1.0f - t) + pos1 * t);
                 float r = r0 * (1.0 - t) + r1 * t;
-                auto node = new Node(pos, 0, r, Vec3(), Vec3(), r);
-                newEdges.push_back(new Edge(prevNode, node));
+                auto node =
+                    arena.create<Node>(pos, 0, r, Vec3(), Vec3(), r);
+                newEdges.push_back(arena.create<Edge>(prevNode, node));
                 prevNode = node;
             }
-            newEdges.push_back(new Edge(prevNode, edge->node1));
-            delete edge;
+            newEdges.push_back(arena.create<Edge>(prevNode, edge->node1));
         }
         else
         {
@@ -20,6 +20,7 @@
 
 #include <unordered_set>
 
+#include "Arena.h"
 #include "AxisAlignedBoundingBox.h"
 
 namespace phyanim
@@ -52,14 +53,6 @@ public:
 
     virtual ~Edge(void);
 
-    Nodes nodes() const
-    {
-        Nodes nodes(2);
-        nodes[0] = node0;
-        nodes[1] = node1;
-        return nodes;
-    };
-
     Edges edges() const
     {
         Edges edges(1);
@@ -82,9 +75,11 @@ void computeLens(Edges& edges);
 
 Nodes uniqueNodes(Edges& edges);
 
-void resample(Edges& edges);
+// Edges must be owned by the arena, new nodes and edges are created in it and
+// replaced edges are left to it
+void resample(Edges& edges, Arena& arena);
 
-void resample(Edges& edges, float len);
+void resample(Edges& edges, float len, Arena& arena);
 
 void removeOutEdges(Edges& edges, AxisAlignedBoundingBox& limits);
 
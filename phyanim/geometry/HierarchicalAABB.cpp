@@ -17,47 +17,234 @@
 
 #include "HierarchicalAABB.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <unordered_map>
+
+#include "PrimitiveNodes.h"
+
+// Primitive ranges above this size are built in a separate OpenMP task
+#define HIERARCHICAL_AABB_TASK_SIZE 4096
+#define HIERARCHICAL_AABB_SAH_BINS 16
+// Dirty leaves above this number are refitted in parallel
+#define HIERARCHICAL_AABB_REFIT_LEAVES 256
+#define HIERARCHICAL_AABB_QUANTIZED_MAX 65535
+#define HIERARCHICAL_AABB_QUANTIZED_MAX_LEAF 127
+#define HIERARCHICAL_AABB_QUANTIZED_MAX_OFFSET 0xFFFFFFu
 
 namespace phyanim
 {
 namespace geometry
 {
-HierarchicalAABB::HierarchicalAABB(Primitives& primitives, uint64_t cellSize)
-    : _child0(nullptr)
-    , _child1(nullptr)
+// Background rebuilds run one at a time and serially, so that trees refitted
+// from an OpenMP loop do not start a thread and a thread team each
+static std::atomic<bool> asyncBuilding(false);
+
+static_assert(sizeof(HierarchicalAABBNode) == 32,
+              "HierarchicalAABBNode must fit in 32 bytes");
+static_assert(sizeof(QuantizedHierarchicalAABBNode) == 16,
+              "QuantizedHierarchicalAABBNode must fit in 16 bytes");
+
+static float surfaceArea(const Vec3& lowerLimit, const Vec3& upperLimit)
+{
+    Vec3 axis = glm::max(upperLimit - lowerLimit, Vec3(0.0f));
+    return 2.0f * (axis.x * axis.y + axis.y * axis.z + axis.z * axis.x);
+}
+
+static uint8_t longestAxis(const Vec3& axis)
+{
+    if (axis.x >= axis.y && axis.x >= axis.z) return 0;
+    if (axis.y >= axis.z) return 1;
+    return 2;
+}
+
+static float nodeCost(const HierarchicalAABBNode& node)
+{
+    float area = surfaceArea(node.lowerLimit, node.upperLimit);
+    return node.isLeaf() ? area * node.size : area;
+}
+
+static bool contains(const HierarchicalAABBNode& node,
+                     const PrimitivePtr primitive)
+{
+    Vec3 lowerLimit = primitive->lowerLimit();
+    Vec3 upperLimit = primitive->upperLimit();
+    return (node.lowerLimit.x <= lowerLimit.x) &&
+           (node.lowerLimit.y <= lowerLimit.y) &&
+           (node.lowerLimit.z <= lowerLimit.z) &&
+           (node.upperLimit.x >= upperLimit.x) &&
+           (node.upperLimit.y >= upperLimit.y) &&
+           (node.upperLimit.z >= upperLimit.z);
+}
+
+// Both ends of the parent box are decoded exactly
+static float dequantize(uint16_t value, float lowerLimit, float upperLimit)
 {
-    _divide(primitives, cellSize);
+    float extent = upperLimit - lowerLimit;
+    if (value <= HIERARCHICAL_AABB_QUANTIZED_MAX / 2)
+        return lowerLimit +
+               extent * ((float)value / HIERARCHICAL_AABB_QUANTIZED_MAX);
+    return upperLimit -
+           extent * ((float)(HIERARCHICAL_AABB_QUANTIZED_MAX - value) /
+                     HIERARCHICAL_AABB_QUANTIZED_MAX);
+}
+
+static uint16_t quantize(float value,
+                         float lowerLimit,
+                         float upperLimit,
+                         bool roundUp)
+{
+    int32_t maxValue = HIERARCHICAL_AABB_QUANTIZED_MAX;
+    float extent = upperLimit - lowerLimit;
+    if (extent <= 0.0f) return roundUp ? maxValue : 0;
+
+    float scaled = (value - lowerLimit) / extent * maxValue;
+    int32_t quantized = roundUp ? std::ceil(scaled) : std::floor(scaled);
+    quantized = std::min(std::max(quantized, 0), maxValue);
+
+    // Fix float rounding so that the decoded limits never shrink the box
+    if (roundUp)
+        while (quantized < maxValue &&
+               dequantize(quantized, lowerLimit, upperLimit) < value)
+            ++quantized;
+    else
+        while (quantized > 0 &&
+               dequantize(quantized, lowerLimit, upperLimit) > value)
+            --quantized;
+    return quantized;
 }
 
-HierarchicalAABB::HierarchicalAABB(Edges& edges, uint64_t cellSize)
-    : _child0(nullptr)
-    , _child1(nullptr)
+HierarchicalAABB::HierarchicalAABB()
+    : rebuildThreshold(0.0f)
+    , asyncRebuild(false)
+    , swept(false)
+    , margin(0.0f)
+    , _cellSize(10)
+    , _splitMethod(MIDPOINT)
+    , _builtSahCost(0.0f)
+    , _sahCostSum(0.0f)
+    , _rebuildData(nullptr)
 {
-    Primitives primitives(edges.begin(), edges.end());
-    _divide(primitives, cellSize);
+}
+
+HierarchicalAABB::HierarchicalAABB(Primitives& primitives,
+                                   uint64_t cellSize,
+                                   SplitMethod splitMethod)
+    : rebuildThreshold(0.0f)
+    , asyncRebuild(false)
+    , swept(false)
+    , margin(0.0f)
+    , _primitives(primitives)
+    , _cellSize(std::max(cellSize, (uint64_t)1))
+    , _splitMethod(splitMethod)
+    , _builtSahCost(0.0f)
+    , _sahCostSum(0.0f)
+    , _rebuildData(nullptr)
+{
+    _build();
+}
+
+HierarchicalAABB::HierarchicalAABB(Edges& edges,
+                                   uint64_t cellSize,
+                                   SplitMethod splitMethod)
+    : rebuildThreshold(0.0f)
+    , asyncRebuild(false)
+    , swept(false)
+    , margin(0.0f)
+    , _primitives(edges.begin(), edges.end())
+    , _cellSize(std::max(cellSize, (uint64_t)1))
+    , _splitMethod(splitMethod)
+    , _builtSahCost(0.0f)
+    , _sahCostSum(0.0f)
+    , _rebuildData(nullptr)
+{
+    _build();
 }
 
 HierarchicalAABB::~HierarchicalAABB()
 {
-    if (_child0)
+    if (_rebuildFuture.valid()) _rebuildFuture.wait();
+    delete _rebuildData;
+    _nodes.clear();
+    _quantizedNodes.clear();
+    _primitives.clear();
+}
+
+void HierarchicalAABB::update()
+{
+    if (compressed()) decompress();
+    _update();
+    _checkRebuild();
+}
+
+uint32_t HierarchicalAABB::refit()
+{
+    if (compressed()) decompress();
+    if (_nodes.empty()) return 0;
+    if (_refitOffsets.empty()) _buildRefitMap();
+
+    // Leaves of the dirty nodes, the clean subtrees are never visited
+    std::vector<uint32_t> leaves;
+    uint32_t numRefitNodes = _refitNodes.size();
+    for (uint32_t i = 0; i < numRefitNodes; ++i)
     {
-        delete _child0;
+        if (!_refitNodes[i]->dirty) continue;
+        for (uint32_t j = _refitOffsets[i]; j < _refitOffsets[i + 1]; ++j)
+        {
+            uint32_t leaf = _refitLeaves[j];
+            if (_dirtyNodes[leaf]) continue;
+            _dirtyNodes[leaf] = 1;
+            leaves.push_back(leaf);
+        }
     }
-    if (_child1)
+
+    uint32_t numLeaves = leaves.size();
+    float sahDelta = 0.0f;
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for reduction(+ : sahDelta) \
+    if (numLeaves > HIERARCHICAL_AABB_REFIT_LEAVES)
+#endif
+    for (uint32_t i = 0; i < numLeaves; ++i)
+        _dirtyNodes[leaves[i]] = _refitNode(leaves[i], sahDelta);
+
+    // Ancestors of the leaves whose limits changed, children first
+    std::vector<uint32_t> inner;
+    for (auto leaf : leaves)
     {
-        delete _child1;
+        bool changed = _dirtyNodes[leaf];
+        _dirtyNodes[leaf] = 0;
+        if (!changed) continue;
+        for (uint32_t id = leaf; id != 0;)
+        {
+            id = _parents[id];
+            if (_dirtyNodes[id]) break;
+            _dirtyNodes[id] = 1;
+            inner.push_back(id);
+        }
+    }
+    std::sort(inner.begin(), inner.end(), std::greater<uint32_t>());
+    for (auto id : inner)
+    {
+        _refitNode(id, sahDelta);
+        _dirtyNodes[id] = 0;
     }
-    _primitives.clear();
-}
 
-void HierarchicalAABB::update() { _update(); }
+    _sahCostSum += sahDelta;
+    _lowerLimit = _nodes[0].lowerLimit;
+    _upperLimit = _nodes[0].upperLimit;
+
+    uint32_t touched = numLeaves + inner.size();
+    if (_checkRebuild()) touched = _nodes.size();
+    return touched;
+}
 
 Nodes HierarchicalAABB::outterNodes(
     const AxisAlignedBoundingBox& axisAlignedBoundingBox)
 {
     Nodes nodes;
-    _outterNodes(axisAlignedBoundingBox, nodes);
+    if (compressed()) decompress();
+    if (!_nodes.empty()) _outterNodes(0, axisAlignedBoundingBox, nodes);
     return nodes;
 }
 
@@ -65,7 +252,9 @@ Primitives HierarchicalAABB::insidePrimitives(
     const AxisAlignedBoundingBox& axisAlignedBoundingBox)
 {
     Primitives primitives;
-    _insidePrimitives(axisAlignedBoundingBox, primitives);
+    if (compressed()) decompress();
+    if (!_nodes.empty())
+        _insidePrimitives(0, axisAlignedBoundingBox, primitives);
     return primitives;
 }
 
@@ -73,7 +262,9 @@ Primitives HierarchicalAABB::collidingPrimitives(
     const AxisAlignedBoundingBox& axisAlignedBoundingBox)
 {
     Primitives primitives;
-    _collidingPrimitives(axisAlignedBoundingBox, primitives);
+    if (compressed()) decompress();
+    if (!_nodes.empty())
+        _collidingPrimitives(0, axisAlignedBoundingBox, primitives);
     return primitives;
 }
 
@@ -81,241 +272,967 @@ PrimitivePairs HierarchicalAABB::collidingPrimitives(
     HierarchicalAABBPtr hierarchicalAABB)
 {
     PrimitivePairs primitivePairs;
-    _collidingPrimitives(this, hierarchicalAABB, primitivePairs);
+    if (compressed() || hierarchicalAABB->compressed())
+    {
+        // Only the pairs with colliding limits are streamed
+        collidingPrimitives(
+            hierarchicalAABB,
+            [&](const PrimitivePair* pairs, uint32_t size) {
+                primitivePairs.insert(primitivePairs.end(), pairs,
+                                      pairs + size);
+            });
+    }
+    else if (!_nodes.empty() && !hierarchicalAABB->_nodes.empty())
+    {
+        _collidingPrimitives(this, 0, hierarchicalAABB, 0, primitivePairs);
+    }
     return primitivePairs;
 }
 
+void HierarchicalAABB::collidingPrimitives(
+    HierarchicalAABBPtr hierarchicalAABB,
+    const PrimitivePairsCallback& callback,
+    float margin)
+{
+    if (numNodes() == 0 || hierarchicalAABB->numNodes() == 0) return;
+    collidingPrimitives(hierarchicalAABB, 0, 0, callback, margin);
+}
+
+void HierarchicalAABB::collidingPrimitives(
+    HierarchicalAABBPtr hierarchicalAABB,
+    uint32_t id0,
+    uint32_t id1,
+    const PrimitivePairsCallback& callback,
+    float margin)
+{
+    PrimitivePairBatch batch;
+    batch.size = 0;
+    batch.callback = &callback;
+    batch.skipAdjacent = false;
+    batch.margin = margin;
+    if (compressed() || hierarchicalAABB->compressed())
+        _quantizedCollidingPrimitives(this, id0, _decodedNode(id0),
+                                      hierarchicalAABB, id1,
+                                      hierarchicalAABB->_decodedNode(id1),
+                                      batch);
+    else
+        _collidingPrimitives(this, id0, hierarchicalAABB, id1, batch);
+    if (batch.size > 0) callback(batch.pairs, batch.size);
+}
+
+IndexPairs HierarchicalAABB::collidingNodes(
+    HierarchicalAABBPtr hierarchicalAABB,
+    uint32_t depth)
+{
+    IndexPairs nodePairs;
+    if (compressed() || hierarchicalAABB->compressed())
+    {
+        // Compressed trees are only traversed from their roots
+        if (numNodes() > 0 && hierarchicalAABB->numNodes() > 0 &&
+            _rootNode().isColliding(hierarchicalAABB->_rootNode()))
+            nodePairs.push_back(std::make_pair(0, 0));
+    }
+    else if (!_nodes.empty() && !hierarchicalAABB->_nodes.empty())
+    {
+        _collidingNodes(this, 0, hierarchicalAABB, 0, depth, nodePairs);
+    }
+    return nodePairs;
+}
+
+void HierarchicalAABB::selfCollidingPrimitives(
+    const PrimitivePairsCallback& callback)
+{
+    if (numNodes() == 0) return;
+    selfCollidingPrimitives(0, 0, callback);
+}
+
+void HierarchicalAABB::selfCollidingPrimitives(
+    uint32_t id0,
+    uint32_t id1,
+    const PrimitivePairsCallback& callback)
+{
+    PrimitivePairBatch batch;
+    batch.size = 0;
+    batch.callback = &callback;
+    batch.skipAdjacent = true;
+    batch.margin = 0.0f;
+    if (compressed() && id0 == id1)
+        _quantizedSelfCollidingPrimitives(id0, _decodedNode(id0), batch);
+    else if (compressed())
+        _quantizedCollidingPrimitives(this, id0, _decodedNode(id0), this, id1,
+                                      _decodedNode(id1), batch);
+    else if (id0 == id1)
+        _selfCollidingPrimitives(id0, batch);
+    else
+        _collidingPrimitives(this, id0, this, id1, batch);
+    if (batch.size > 0) callback(batch.pairs, batch.size);
+}
+
+IndexPairs HierarchicalAABB::selfCollidingNodes(uint32_t depth)
+{
+    IndexPairs nodePairs;
+    if (compressed())
+        nodePairs.push_back(std::make_pair(0, 0));
+    else if (!_nodes.empty())
+        _selfCollidingNodes(0, depth, nodePairs);
+    return nodePairs;
+}
+
+bool HierarchicalAABB::compress()
+{
+    if (compressed()) return true;
+    if (_rebuildFuture.valid())
+    {
+        _rebuildFuture.wait();
+        _checkRebuild();
+    }
+    if (_nodes.empty() ||
+        _primitives.size() > HIERARCHICAL_AABB_QUANTIZED_MAX_OFFSET ||
+        _nodes.size() >= HIERARCHICAL_AABB_QUANTIZED_LEAF)
+        return false;
+    for (auto& node : _nodes)
+        if (node.size > HIERARCHICAL_AABB_QUANTIZED_MAX_LEAF) return false;
+
+    // Children are encoded relative to the decoded parent, as in traversals
+    HierarchicalAABBNode box;
+    box.lowerLimit = _lowerLimit;
+    box.upperLimit = _upperLimit;
+    _quantizedNodes.resize(_nodes.size());
+    _compress(0, box);
+    HierarchicalAABBNodes().swap(_nodes);
+    _clearRefitMap();
+    return true;
+}
+
+void HierarchicalAABB::decompress()
+{
+    if (!compressed()) return;
+
+    uint32_t size = _quantizedNodes.size();
+    _nodes.resize(size);
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        auto& quantizedNode = _quantizedNodes[i];
+        auto& node = _nodes[i];
+        if (quantizedNode.isLeaf())
+        {
+            node.offset =
+                quantizedNode.data & HIERARCHICAL_AABB_QUANTIZED_MAX_OFFSET;
+            node.size = (quantizedNode.data >> 24) &
+                        HIERARCHICAL_AABB_QUANTIZED_MAX_LEAF;
+        }
+        else
+        {
+            node.offset = quantizedNode.data;
+            node.size = 0;
+        }
+    }
+    QuantizedHierarchicalAABBNodes().swap(_quantizedNodes);
+    _update();
+}
+
+bool HierarchicalAABB::compressed() const { return !_quantizedNodes.empty(); }
+
+uint64_t HierarchicalAABB::nodesMemory() const
+{
+    return _nodes.capacity() * sizeof(HierarchicalAABBNode) +
+           _quantizedNodes.capacity() * sizeof(QuantizedHierarchicalAABBNode) +
+           _dirtyNodes.capacity() + _refitNodes.capacity() * sizeof(NodePtr) +
+           (_refitOffsets.capacity() + _refitLeaves.capacity() +
+            _parents.capacity()) *
+               sizeof(uint32_t);
+}
+
 Edges HierarchicalAABB::insideEdges(
     const AxisAlignedBoundingBox& axisAlignedBoundingBox)
 {
-    Primitives primitives;
-    _insidePrimitives(axisAlignedBoundingBox, primitives);
     Edges edges;
-    for (auto prim : primitives)
-        if (auto edge = dynamic_cast<Edge*>(prim)) edges.push_back(edge);
+    for (auto prim : insidePrimitives(axisAlignedBoundingBox))
+        if (prim->type() == EDGE) edges.push_back(static_cast<Edge*>(prim));
     return edges;
 }
 
 Edges HierarchicalAABB::collidingEdges(
     const AxisAlignedBoundingBox& axisAlignedBoundingBox)
 {
-    Primitives primitives;
-    _collidingPrimitives(axisAlignedBoundingBox, primitives);
     Edges edges;
-    for (auto prim : primitives)
-        if (auto edge = dynamic_cast<Edge*>(prim)) edges.push_back(edge);
+    for (auto prim : collidingPrimitives(axisAlignedBoundingBox))
+        if (prim->type() == EDGE) edges.push_back(static_cast<Edge*>(prim));
     return edges;
 }
 
+uint32_t HierarchicalAABB::numNodes() const
+{
+    return compressed() ? _quantizedNodes.size() : _nodes.size();
+}
+
+const Primitives& HierarchicalAABB::primitives() const { return _primitives; }
+
+void HierarchicalAABB::_build()
+{
+    _clear();
+    _nodes.clear();
+    _sahCostSum = 0.0f;
+    _builtSahCost = 0.0f;
+    if (_primitives.empty()) return;
+
+    uint32_t size = _primitives.size();
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel for if (size > HIERARCHICAL_AABB_TASK_SIZE)
+#endif
+    for (uint32_t i = 0; i < size; ++i) _primitives[i]->update(swept);
+
+    auto data = _snapshot();
+    _buildTree(*data);
+    _install(*data);
+    delete data;
+}
+
 void HierarchicalAABB::_update()
 {
-    if (_primitives.size() > 0)
-    {
-        this->AxisAlignedBoundingBox::update(_primitives);
-        for (auto primitive : _primitives)
-        {
-            primitive->update();
-        }
-    }
-    else
+    if (_nodes.empty()) return;
+
+    float sahCostSum = 0.0f;
+    for (uint32_t i = _nodes.size(); i-- > 0;)
     {
-        _clear();
-        if (_child0)
+        auto& node = _nodes[i];
+        node.lowerLimit = maxVec3;
+        node.upperLimit = minVec3;
+        if (node.isLeaf())
         {
-            _child0->_update();
-            unite(*_child0);
+            for (uint32_t j = node.offset; j < node.offset + node.size; ++j)
+            {
+                auto primitive = _primitives[j];
+                primitive->update(swept);
+                node.lowerLimit =
+                    glm::min(node.lowerLimit, primitive->lowerLimit());
+                node.upperLimit =
+                    glm::max(node.upperLimit, primitive->upperLimit());
+            }
+            node.lowerLimit -= margin;
+            node.upperLimit += margin;
         }
-        if (_child1)
+        else
         {
-            _child1->_update();
-            unite(*_child1);
+            auto& child0 = _nodes[i + 1];
+            auto& child1 = _nodes[node.offset];
+            node.lowerLimit = glm::min(child0.lowerLimit, child1.lowerLimit);
+            node.upperLimit = glm::max(child0.upperLimit, child1.upperLimit);
         }
+        sahCostSum += nodeCost(node);
     }
+    _sahCostSum = sahCostSum;
+    _lowerLimit = _nodes[0].lowerLimit;
+    _upperLimit = _nodes[0].upperLimit;
 }
 
-void HierarchicalAABB::_divide(Primitives& primitives, uint64_t cellSize)
+HierarchicalAABB::BuildData* HierarchicalAABB::_snapshot() const
 {
-    this->AxisAlignedBoundingBox::update(primitives);
-    if (primitives.size() <= cellSize)
+    auto data = new BuildData();
+    uint32_t size = _primitives.size();
+    data->primitives.resize(size);
+    for (uint32_t i = 0; i < size; ++i)
     {
-        _primitives = primitives;
-        return;
+        auto primitive = _primitives[i];
+        auto& buildPrimitive = data->primitives[i];
+        buildPrimitive.lowerLimit = primitive->lowerLimit();
+        buildPrimitive.upperLimit = primitive->upperLimit();
+        buildPrimitive.center = primitive->center();
+        buildPrimitive.id = i;
     }
-    else
+    data->nodes.resize(2 * size);
+    data->numNodes = 1;
+    data->cellSize = _cellSize;
+    data->splitMethod = _splitMethod;
+    return data;
+}
+
+void HierarchicalAABB::_buildTree(BuildData& data, bool parallel)
+{
+    uint32_t size = data.primitives.size();
+    if (size == 0) return;
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp parallel if (parallel && size > HIERARCHICAL_AABB_TASK_SIZE)
+#pragma omp single
+#endif
+    _divide(data, 0, 0, size);
+}
+
+void HierarchicalAABB::_install(BuildData& data)
+{
+    uint32_t size = _primitives.size();
+    Primitives primitives(size);
+    for (uint32_t i = 0; i < size; ++i)
+        primitives[i] = _primitives[data.primitives[i].id];
+    _primitives.swap(primitives);
+
+    _nodes.clear();
+    _nodes.reserve(data.numNodes);
+    _flatten(data.nodes, 0);
+    _clearRefitMap();
+
+    _lowerLimit = _nodes[0].lowerLimit;
+    _upperLimit = _nodes[0].upperLimit;
+    _sahCostSum = 0.0f;
+    for (auto& node : _nodes) _sahCostSum += nodeCost(node);
+    _builtSahCost = sahCost();
+}
+
+bool HierarchicalAABB::_checkRebuild()
+{
+    if (_rebuildFuture.valid())
+    {
+        if (_rebuildFuture.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready)
+            return false;
+
+        // The snapshot bounds are outdated, refit the new tree before use
+        _rebuildFuture.get();
+        _install(*_rebuildData);
+        delete _rebuildData;
+        _rebuildData = nullptr;
+        _update();
+        _builtSahCost = sahCost();
+        return true;
+    }
+
+    if (rebuildThreshold <= 0.0f || sahCostRatio() < rebuildThreshold)
+        return false;
+
+    if (asyncRebuild)
+    {
+        // Trees waiting for the running build retry on their next check
+        bool building = false;
+        if (!asyncBuilding.compare_exchange_strong(building, true))
+            return false;
+        BuildData* data = _snapshot();
+        _rebuildData = data;
+        _rebuildFuture = std::async(std::launch::async, [data]() {
+            _buildTree(*data, false);
+            asyncBuilding = false;
+        });
+        return false;
+    }
+    _build();
+    return true;
+}
+
+void HierarchicalAABB::_divide(BuildData& data,
+                               uint32_t id,
+                               uint32_t begin,
+                               uint32_t end)
+{
+    Vec3 lowerLimit = maxVec3;
+    Vec3 upperLimit = minVec3;
+    Vec3 lowerCenter = maxVec3;
+    Vec3 upperCenter = minVec3;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        auto& primitive = data.primitives[i];
+        lowerLimit = glm::min(lowerLimit, primitive.lowerLimit);
+        upperLimit = glm::max(upperLimit, primitive.upperLimit);
+        lowerCenter = glm::min(lowerCenter, primitive.center);
+        upperCenter = glm::max(upperCenter, primitive.center);
+    }
+
+    auto& node = data.nodes[id];
+    node.lowerLimit = lowerLimit;
+    node.upperLimit = upperLimit;
+    node.begin = begin;
+    node.end = end;
+    node.child0 = -1;
+    node.child1 = -1;
+
+    if (end - begin <= data.cellSize) return;
+
+    uint32_t split = _split(data, begin, end, lowerLimit, upperLimit,
+                            lowerCenter, upperCenter);
+
+    uint32_t child0 = data.numNodes.fetch_add(2);
+    uint32_t child1 = child0 + 1;
+    node.child0 = child0;
+    node.child1 = child1;
+
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp task shared(data) if (split - begin > HIERARCHICAL_AABB_TASK_SIZE)
+#endif
+    _divide(data, child0, begin, split);
+    _divide(data, child1, split, end);
+#ifdef PHYANIM_USES_OPENMP
+#pragma omp taskwait
+#endif
+}
+
+uint32_t HierarchicalAABB::_split(BuildData& data,
+                                  uint32_t begin,
+                                  uint32_t end,
+                                  const Vec3& lowerLimit,
+                                  const Vec3& upperLimit,
+                                  const Vec3& lowerCenter,
+                                  const Vec3& upperCenter)
+{
+    auto first = data.primitives.begin() + begin;
+    auto last = data.primitives.begin() + end;
+    uint32_t split = begin;
+
+    if (data.splitMethod == MIDPOINT)
     {
-        Vec3 axis = _upperLimit - _lowerLimit;
-        Vec3 center = this->center();
-        uint8_t divCoord = 0;
-        Primitives child0Primitives;
-        Primitives child1Primitives;
-        if (axis.x >= axis.y && axis.x >= axis.z)
+        uint8_t axis = longestAxis(upperLimit - lowerLimit);
+        float center = (lowerLimit[axis] + upperLimit[axis]) * 0.5f;
+        split = std::partition(first, last,
+                               [&](const BuildPrimitive& primitive) {
+                                   return primitive.center[axis] <= center;
+                               }) -
+                data.primitives.begin();
+    }
+    else if (data.splitMethod == SAH)
+    {
+        split = _sahSplit(data, begin, end, lowerCenter, upperCenter);
+    }
+
+    // Median split, also used when the other methods leave one side empty
+    if (split <= begin || split >= end)
+    {
+        uint8_t axis = longestAxis(upperCenter - lowerCenter);
+        split = (begin + end) / 2;
+        std::nth_element(first, data.primitives.begin() + split, last,
+                         [&](const BuildPrimitive& primitive0,
+                             const BuildPrimitive& primitive1) {
+                             return primitive0.center[axis] <
+                                    primitive1.center[axis];
+                         });
+    }
+    return split;
+}
+
+uint32_t HierarchicalAABB::_sahSplit(BuildData& data,
+                                     uint32_t begin,
+                                     uint32_t end,
+                                     const Vec3& lowerCenter,
+                                     const Vec3& upperCenter)
+{
+    const uint32_t numBins = HIERARCHICAL_AABB_SAH_BINS;
+    Vec3 extent = upperCenter - lowerCenter;
+    float bestCost = std::numeric_limits<float>::max();
+    int8_t bestAxis = -1;
+    uint32_t bestBin = 0;
+
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+        if (extent[axis] <= 0.0f) continue;
+        float scale = numBins / extent[axis];
+
+        Vec3 binLower[numBins];
+        Vec3 binUpper[numBins];
+        uint32_t binCount[numBins];
+        for (uint32_t b = 0; b < numBins; ++b)
         {
-            divCoord = 0;
+            binLower[b] = maxVec3;
+            binUpper[b] = minVec3;
+            binCount[b] = 0;
         }
-        else if (axis.y >= axis.z)
+        for (uint32_t i = begin; i < end; ++i)
         {
-            divCoord = 1;
+            auto& primitive = data.primitives[i];
+            uint32_t b = std::min(
+                numBins - 1,
+                (uint32_t)((primitive.center[axis] - lowerCenter[axis]) *
+                           scale));
+            ++binCount[b];
+            binLower[b] = glm::min(binLower[b], primitive.lowerLimit);
+            binUpper[b] = glm::max(binUpper[b], primitive.upperLimit);
         }
-        else
+
+        float rightCost[numBins];
+        Vec3 lower = maxVec3;
+        Vec3 upper = minVec3;
+        uint32_t count = 0;
+        for (uint32_t b = numBins - 1; b > 0; --b)
         {
-            divCoord = 2;
+            lower = glm::min(lower, binLower[b]);
+            upper = glm::max(upper, binUpper[b]);
+            count += binCount[b];
+            rightCost[b] = count > 0 ? surfaceArea(lower, upper) * count : 0.0f;
         }
-        for (auto primitive : primitives)
+
+        lower = maxVec3;
+        upper = minVec3;
+        count = 0;
+        for (uint32_t b = 0; b < numBins - 1; ++b)
         {
-            if (primitive->center()[divCoord] <= center[divCoord])
+            lower = glm::min(lower, binLower[b]);
+            upper = glm::max(upper, binUpper[b]);
+            count += binCount[b];
+            if (count == 0 || count == end - begin) continue;
+            float cost = surfaceArea(lower, upper) * count + rightCost[b + 1];
+            if (cost < bestCost)
             {
-                child0Primitives.push_back(primitive);
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
             }
-            else
+        }
+    }
+
+    if (bestAxis < 0) return begin;
+
+    float scale = numBins / extent[bestAxis];
+    return std::partition(data.primitives.begin() + begin,
+                          data.primitives.begin() + end,
+                          [&](const BuildPrimitive& primitive) {
+                              uint32_t b = std::min(
+                                  numBins - 1,
+                                  (uint32_t)((primitive.center[bestAxis] -
+                                              lowerCenter[bestAxis]) *
+                                             scale));
+                              return b <= bestBin;
+                          }) -
+           data.primitives.begin();
+}
+
+uint32_t HierarchicalAABB::_flatten(const BuildNodes& buildNodes, uint32_t id)
+{
+    auto& buildNode = buildNodes[id];
+    uint32_t flatId = _nodes.size();
+    _nodes.push_back(HierarchicalAABBNode());
+    _nodes[flatId].lowerLimit = buildNode.lowerLimit - margin;
+    _nodes[flatId].upperLimit = buildNode.upperLimit + margin;
+
+    if (buildNode.child0 < 0)
+    {
+        _nodes[flatId].offset = buildNode.begin;
+        _nodes[flatId].size = buildNode.end - buildNode.begin;
+    }
+    else
+    {
+        _flatten(buildNodes, buildNode.child0);
+        _nodes[flatId].offset = _flatten(buildNodes, buildNode.child1);
+        _nodes[flatId].size = 0;
+    }
+    return flatId;
+}
+
+void HierarchicalAABB::_buildRefitMap()
+{
+    uint32_t numNodes = _nodes.size();
+    _parents.assign(numNodes, 0);
+    _refitNodes.clear();
+    std::unordered_map<NodePtr, uint32_t> ids;
+    std::vector<std::pair<uint32_t, uint32_t>> nodeLeaves;
+    for (uint32_t id = 0; id < numNodes; ++id)
+    {
+        auto& node = _nodes[id];
+        if (!node.isLeaf())
+        {
+            _parents[id + 1] = id;
+            _parents[node.offset] = id;
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.size; ++i)
+        {
+            for (auto meshNode : _primitives[i]->nodes())
             {
-                child1Primitives.push_back(primitive);
+                auto it = ids.emplace(meshNode, _refitNodes.size());
+                if (it.second) _refitNodes.push_back(meshNode);
+                nodeLeaves.push_back(std::make_pair(it.first->second, id));
             }
         }
+    }
+    std::sort(nodeLeaves.begin(), nodeLeaves.end());
+    nodeLeaves.erase(std::unique(nodeLeaves.begin(), nodeLeaves.end()),
+                     nodeLeaves.end());
 
-        if (child0Primitives.size() > 0 && child1Primitives.size() > 0)
-        {
-            _child0 = new HierarchicalAABB(child0Primitives, cellSize);
-            _child1 = new HierarchicalAABB(child1Primitives, cellSize);
+    _refitOffsets.assign(_refitNodes.size() + 1, 0);
+    _refitLeaves.resize(nodeLeaves.size());
+    for (uint32_t i = 0; i < nodeLeaves.size(); ++i)
+    {
+        ++_refitOffsets[nodeLeaves[i].first + 1];
+        _refitLeaves[i] = nodeLeaves[i].second;
+    }
+    for (uint32_t i = 0; i < _refitNodes.size(); ++i)
+        _refitOffsets[i + 1] += _refitOffsets[i];
+    _dirtyNodes.assign(numNodes, 0);
+}
+
+void HierarchicalAABB::_clearRefitMap()
+{
+    Nodes().swap(_refitNodes);
+    std::vector<uint32_t>().swap(_refitOffsets);
+    std::vector<uint32_t>().swap(_refitLeaves);
+    std::vector<uint32_t>().swap(_parents);
+    std::vector<uint8_t>().swap(_dirtyNodes);
+}
 
-            this->AxisAlignedBoundingBox::update(*_child0);
-            this->unite(*_child1);
+void HierarchicalAABB::_compress(uint32_t id,
+                                 const HierarchicalAABBNode& parent)
+{
+    auto& node = _nodes[id];
+    auto& quantizedNode = _quantizedNodes[id];
+    HierarchicalAABBNode decoded = node;
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        float lower = parent.lowerLimit[i];
+        float upper = parent.upperLimit[i];
+        quantizedNode.lowerLimit[i] =
+            quantize(node.lowerLimit[i], lower, upper, false);
+        quantizedNode.upperLimit[i] =
+            quantize(node.upperLimit[i], lower, upper, true);
+        decoded.lowerLimit[i] =
+            dequantize(quantizedNode.lowerLimit[i], lower, upper);
+        decoded.upperLimit[i] =
+            dequantize(quantizedNode.upperLimit[i], lower, upper);
+    }
+
+    if (node.isLeaf())
+    {
+        quantizedNode.data = HIERARCHICAL_AABB_QUANTIZED_LEAF |
+                             (node.size << 24) | node.offset;
+    }
+    else
+    {
+        quantizedNode.data = node.offset;
+        _compress(id + 1, decoded);
+        _compress(node.offset, decoded);
+    }
+}
+
+HierarchicalAABBNode HierarchicalAABB::_rootNode() const
+{
+    HierarchicalAABBNode box;
+    box.lowerLimit = _lowerLimit;
+    box.upperLimit = _upperLimit;
+    return _node(0, box);
+}
+
+HierarchicalAABBNode HierarchicalAABB::_decodedNode(uint32_t id) const
+{
+    if (!compressed()) return _nodes[id];
+
+    // Limits are relative to the parent, descend from the root to the node.
+    // Nodes are in depth first order, the right child is the first node of
+    // the subtree at or below the id
+    uint32_t current = 0;
+    auto node = _rootNode();
+    while (current != id && !node.isLeaf())
+    {
+        uint32_t child = id >= node.offset ? node.offset : current + 1;
+        node = _node(child, node);
+        current = child;
+    }
+    return node;
+}
+
+HierarchicalAABBNode HierarchicalAABB::_node(
+    uint32_t id,
+    const HierarchicalAABBNode& parent) const
+{
+    if (!compressed()) return _nodes[id];
+
+    auto& quantizedNode = _quantizedNodes[id];
+    HierarchicalAABBNode node;
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        float lower = parent.lowerLimit[i];
+        float upper = parent.upperLimit[i];
+        node.lowerLimit[i] =
+            dequantize(quantizedNode.lowerLimit[i], lower, upper);
+        node.upperLimit[i] =
+            dequantize(quantizedNode.upperLimit[i], lower, upper);
+    }
+    if (quantizedNode.isLeaf())
+    {
+        node.offset =
+            quantizedNode.data & HIERARCHICAL_AABB_QUANTIZED_MAX_OFFSET;
+        node.size =
+            (quantizedNode.data >> 24) & HIERARCHICAL_AABB_QUANTIZED_MAX_LEAF;
+    }
+    else
+    {
+        node.offset = quantizedNode.data;
+        node.size = 0;
+    }
+    return node;
+}
+
+bool HierarchicalAABB::_refitNode(uint32_t id, float& sahDelta)
+{
+    auto& node = _nodes[id];
+    float cost = nodeCost(node);
+    bool dirty = false;
+    if (node.isLeaf())
+    {
+        uint32_t end = node.offset + node.size;
+        bool escaped = false;
+        for (uint32_t i = node.offset; i < end; ++i)
+        {
+            auto primitive = _primitives[i];
+            if (primitive->dirty())
+            {
+                primitive->update(swept);
+                dirty = true;
+                escaped = escaped || !contains(node, primitive);
+            }
         }
-        else
+
+        // Enlarged leaves are kept while they still contain their primitives
+        if (margin > 0.0f) dirty = escaped;
+        if (dirty)
         {
-            _primitives = primitives;
+            node.lowerLimit = maxVec3;
+            node.upperLimit = minVec3;
+            for (uint32_t i = node.offset; i < end; ++i)
+            {
+                node.lowerLimit =
+                    glm::min(node.lowerLimit, _primitives[i]->lowerLimit());
+                node.upperLimit =
+                    glm::max(node.upperLimit, _primitives[i]->upperLimit());
+            }
+            node.lowerLimit -= margin;
+            node.upperLimit += margin;
         }
     }
+    else
+    {
+        dirty = true;
+        auto& child0 = _nodes[id + 1];
+        auto& child1 = _nodes[node.offset];
+        node.lowerLimit = glm::min(child0.lowerLimit, child1.lowerLimit);
+        node.upperLimit = glm::max(child0.upperLimit, child1.upperLimit);
+    }
+    if (dirty) sahDelta += nodeCost(node) - cost;
+    return dirty;
+}
+
+HierarchicalAABBStats HierarchicalAABB::stats() const
+{
+    HierarchicalAABBStats stats;
+    stats.numNodes = numNodes();
+    stats.numLeaves = 0;
+    stats.maxDepth = 0;
+    stats.meanDepth = 0.0f;
+    stats.minLeafSize = 0;
+    stats.maxLeafSize = 0;
+    stats.meanLeafSize = 0.0f;
+    stats.sahCost = 0.0f;
+    if (stats.numNodes == 0) return stats;
+
+    stats.minLeafSize = std::numeric_limits<uint32_t>::max();
+    _stats(0, _rootNode(), 0, stats);
+    stats.meanDepth /= stats.numLeaves;
+    stats.meanLeafSize = (float)_primitives.size() / stats.numLeaves;
+    stats.sahCost = sahCost();
+    return stats;
+}
+
+void HierarchicalAABB::_stats(uint32_t id,
+                              const HierarchicalAABBNode& node,
+                              uint32_t depth,
+                              HierarchicalAABBStats& stats) const
+{
+    if (node.isLeaf())
+    {
+        ++stats.numLeaves;
+        stats.maxDepth = std::max(stats.maxDepth, depth);
+        stats.meanDepth += depth;
+        stats.minLeafSize = std::min(stats.minLeafSize, node.size);
+        stats.maxLeafSize = std::max(stats.maxLeafSize, node.size);
+    }
+    else
+    {
+        _stats(id + 1, _node(id + 1, node), depth + 1, stats);
+        _stats(node.offset, _node(node.offset, node), depth + 1, stats);
+    }
+}
+
+// Surface area heuristic with unit traversal and intersection costs, relative
+// to the root area
+float HierarchicalAABB::sahCost() const
+{
+    if (compressed()) return _quantizedCost(0, _rootNode()) / _rootArea();
+    if (_nodes.empty()) return 0.0f;
+
+    float cost = 0.0f;
+    for (auto& node : _nodes) cost += nodeCost(node);
+    return cost / _rootArea();
 }
 
-void HierarchicalAABB::_outterNodes(const AxisAlignedBoundingBox& aabb,
+float HierarchicalAABB::sahCostRatio() const
+{
+    if (_builtSahCost <= 0.0f) return 1.0f;
+    if (compressed()) return sahCost() / _builtSahCost;
+    if (_nodes.empty()) return 1.0f;
+    return _sahCostSum / _rootArea() / _builtSahCost;
+}
+
+float HierarchicalAABB::_rootArea() const
+{
+    float rootArea = surfaceArea(_lowerLimit, _upperLimit);
+    return rootArea > 0.0f ? rootArea : 1.0f;
+}
+
+float HierarchicalAABB::_quantizedCost(uint32_t id,
+                                       const HierarchicalAABBNode& node) const
+{
+    float cost = nodeCost(node);
+    if (!node.isLeaf())
+    {
+        cost += _quantizedCost(id + 1, _node(id + 1, node));
+        cost += _quantizedCost(node.offset, _node(node.offset, node));
+    }
+    return cost;
+}
+
+void HierarchicalAABB::_outterNodes(uint32_t id,
+                                    const AxisAlignedBoundingBox& aabb,
                                     Nodes& nodes)
 {
-    if (_child0 && _child1)
+    auto& node = _nodes[id];
+    if (!node.isLeaf())
     {
-        if (!aabb.isInside(*_child0))
+        uint32_t child0 = id + 1;
+        uint32_t child1 = node.offset;
+        if (!aabb.isInside(_nodes[child0].lowerLimit,
+                           _nodes[child0].upperLimit))
         {
-            _child0->_outterNodes(aabb, nodes);
+            _outterNodes(child0, aabb, nodes);
         }
-        if (!aabb.isInside(*_child1))
+        if (!aabb.isInside(_nodes[child1].lowerLimit,
+                           _nodes[child1].upperLimit))
         {
-            _child1->_outterNodes(aabb, nodes);
+            _outterNodes(child1, aabb, nodes);
         }
     }
     else
     {
-        for (auto primitive : _primitives)
+        for (uint32_t i = node.offset; i < node.offset + node.size; ++i)
         {
-            for (auto node : primitive->nodes())
+            for (auto n : _primitives[i]->nodes())
             {
-                if (!aabb.isInside(node->position))
+                if (!aabb.isInside(n->position))
                 {
-                    nodes.push_back(node);
+                    nodes.push_back(n);
                 }
             }
         }
     }
 }
 
-void HierarchicalAABB::_insidePrimitives(const AxisAlignedBoundingBox& aabb,
+void HierarchicalAABB::_insidePrimitives(uint32_t id,
+                                         const AxisAlignedBoundingBox& aabb,
                                          Primitives& primitives)
 {
-    if (_child0 && _child1)
+    auto& node = _nodes[id];
+    if (!node.isLeaf())
     {
-        if (aabb.isColliding(*_child0))
+        uint32_t child0 = id + 1;
+        uint32_t child1 = node.offset;
+        if (aabb.isColliding(_nodes[child0].lowerLimit,
+                             _nodes[child0].upperLimit))
         {
-            _child0->_insidePrimitives(aabb, primitives);
+            _insidePrimitives(child0, aabb, primitives);
         }
-        if (aabb.isColliding(*_child1))
+        if (aabb.isColliding(_nodes[child1].lowerLimit,
+                             _nodes[child1].upperLimit))
         {
-            _child1->_insidePrimitives(aabb, primitives);
+            _insidePrimitives(child1, aabb, primitives);
         }
     }
     else
     {
-        for (auto primitive : _primitives)
+        for (uint32_t i = node.offset; i < node.offset + node.size; ++i)
         {
-            if (aabb.isInside(*primitive))
+            if (aabb.isInside(*_primitives[i]))
             {
-                primitives.push_back(primitive);
+                primitives.push_back(_primitives[i]);
             }
         }
     }
 }
 
-void HierarchicalAABB::_collidingPrimitives(const AxisAlignedBoundingBox& aabb,
+void HierarchicalAABB::_collidingPrimitives(uint32_t id,
+                                            const AxisAlignedBoundingBox& aabb,
                                             Primitives& primitives)
 {
-    if (_child0 && _child1)
+    auto& node = _nodes[id];
+    if (!node.isLeaf())
     {
-        if (aabb.isColliding(*_child0))
+        uint32_t child0 = id + 1;
+        uint32_t child1 = node.offset;
+        if (aabb.isColliding(_nodes[child0].lowerLimit,
+                             _nodes[child0].upperLimit))
         {
-            _child0->_collidingPrimitives(aabb, primitives);
+            _collidingPrimitives(child0, aabb, primitives);
         }
-        if (aabb.isColliding(*_child1))
+        if (aabb.isColliding(_nodes[child1].lowerLimit,
+                             _nodes[child1].upperLimit))
         {
-            _child1->_collidingPrimitives(aabb, primitives);
+            _collidingPrimitives(child1, aabb, primitives);
         }
     }
     else
     {
-        for (auto primitive : _primitives)
+        for (uint32_t i = node.offset; i < node.offset + node.size; ++i)
         {
-            if (aabb.isColliding(*primitive))
+            if (aabb.isColliding(*_primitives[i]))
             {
-                primitives.push_back(primitive);
+                primitives.push_back(_primitives[i]);
             }
         }
     }
 }
 
 void HierarchicalAABB::_collidingPrimitives(HierarchicalAABBPtr aabb0,
+                                            uint32_t id0,
                                             HierarchicalAABBPtr aabb1,
+                                            uint32_t id1,
                                             PrimitivePairs& primitivesPairs)
 {
-    if (aabb0->isColliding(*aabb1))
+    auto& node0 = aabb0->_nodes[id0];
+    auto& node1 = aabb1->_nodes[id1];
+    if (node0.isColliding(node1))
     {
-        if (aabb0->_child0 && aabb0->_child1)
+        if (!node0.isLeaf())
         {
-            if (aabb1->_child0 && aabb1->_child1)
+            if (!node1.isLeaf())
             {
-                _collidingPrimitives(aabb0->_child0, aabb1->_child0,
+                _collidingPrimitives(aabb0, id0 + 1, aabb1, id1 + 1,
                                      primitivesPairs);
-                _collidingPrimitives(aabb0->_child0, aabb1->_child1,
+                _collidingPrimitives(aabb0, id0 + 1, aabb1, node1.offset,
                                      primitivesPairs);
-                _collidingPrimitives(aabb0->_child1, aabb1->_child0,
+                _collidingPrimitives(aabb0, node0.offset, aabb1, id1 + 1,
                                      primitivesPairs);
-                _collidingPrimitives(aabb0->_child1, aabb1->_child1,
+                _collidingPrimitives(aabb0, node0.offset, aabb1, node1.offset,
                                      primitivesPairs);
             }
             else
             {
-                _collidingPrimitives(aabb0->_child0, aabb1, primitivesPairs);
-                _collidingPrimitives(aabb0->_child1, aabb1, primitivesPairs);
+                _collidingPrimitives(aabb0, id0 + 1, aabb1, id1,
+                                     primitivesPairs);
+                _collidingPrimitives(aabb0, node0.offset, aabb1, id1,
+                                     primitivesPairs);
             }
         }
         else
         {
-            if (aabb1->_child0 && aabb1->_child1)
+            if (!node1.isLeaf())
             {
-                _collidingPrimitives(aabb0, aabb1->_child0, primitivesPairs);
-                _collidingPrimitives(aabb0, aabb1->_child1, primitivesPairs);
+                _collidingPrimitives(aabb0, id0, aabb1, id1 + 1,
+                                     primitivesPairs);
+                _collidingPrimitives(aabb0, id0, aabb1, node1.offset,
+                                     primitivesPairs);
             }
             else
             {
-                for (auto prim0 : aabb0->_primitives)
+                auto& primitives0 = aabb0->_primitives;
+                auto& primitives1 = aabb1->_primitives;
+                for (uint32_t i = node0.offset; i < node0.offset + node0.size;
+                     ++i)
                 {
-                    for (auto prim1 : aabb1->_primitives)
+                    for (uint32_t j = node1.offset;
+                         j < node1.offset + node1.size; ++j)
                     {
-                        // if (prim0 == prim1) continue;
-
-                        // bool shared = false;
-                        // for (auto node0 : prim0->nodes())
-                        //     for (auto node1 : prim1->nodes())
-                        //         shared |= (node0 == node1);
-                        // if (shared) continue;
-
-                        // if (prim0->areLimitsColliding(prim1))
-                        primitivesPairs.push_back(std::make_pair(prim0, prim1));
+                        primitivesPairs.push_back(
+                            std::make_pair(primitives0[i], primitives1[j]));
                     }
                 }
             }
@@ -323,5 +1240,207 @@ void HierarchicalAABB::_collidingPrimitives(HierarchicalAABBPtr aabb0,
     }
 }
 
+void HierarchicalAABB::_collidingPrimitives(HierarchicalAABBPtr aabb0,
+                                            uint32_t id0,
+                                            HierarchicalAABBPtr aabb1,
+                                            uint32_t id1,
+                                            PrimitivePairBatch& batch)
+{
+    auto& node0 = aabb0->_nodes[id0];
+    auto& node1 = aabb1->_nodes[id1];
+    if (!node0.isColliding(node1, batch.margin)) return;
+
+    if (!node0.isLeaf() && !node1.isLeaf())
+    {
+        _collidingPrimitives(aabb0, id0 + 1, aabb1, id1 + 1, batch);
+        _collidingPrimitives(aabb0, id0 + 1, aabb1, node1.offset, batch);
+        _collidingPrimitives(aabb0, node0.offset, aabb1, id1 + 1, batch);
+        _collidingPrimitives(aabb0, node0.offset, aabb1, node1.offset, batch);
+    }
+    else if (!node0.isLeaf())
+    {
+        _collidingPrimitives(aabb0, id0 + 1, aabb1, id1, batch);
+        _collidingPrimitives(aabb0, node0.offset, aabb1, id1, batch);
+    }
+    else if (!node1.isLeaf())
+    {
+        _collidingPrimitives(aabb0, id0, aabb1, id1 + 1, batch);
+        _collidingPrimitives(aabb0, id0, aabb1, node1.offset, batch);
+    }
+    else
+    {
+        auto& primitives0 = aabb0->_primitives;
+        auto& primitives1 = aabb1->_primitives;
+        for (uint32_t i = node0.offset; i < node0.offset + node0.size; ++i)
+            for (uint32_t j = node1.offset; j < node1.offset + node1.size; ++j)
+                _pushPair(primitives0[i], primitives1[j], batch);
+    }
+}
+
+void HierarchicalAABB::_quantizedCollidingPrimitives(
+    HierarchicalAABBPtr aabb0,
+    uint32_t id0,
+    const HierarchicalAABBNode& node0,
+    HierarchicalAABBPtr aabb1,
+    uint32_t id1,
+    const HierarchicalAABBNode& node1,
+    PrimitivePairBatch& batch)
+{
+    if (!node0.isColliding(node1, batch.margin)) return;
+
+    if (!node0.isLeaf() && !node1.isLeaf())
+    {
+        uint32_t child00 = id0 + 1;
+        uint32_t child01 = node0.offset;
+        uint32_t child10 = id1 + 1;
+        uint32_t child11 = node1.offset;
+        auto node00 = aabb0->_node(child00, node0);
+        auto node01 = aabb0->_node(child01, node0);
+        auto node10 = aabb1->_node(child10, node1);
+        auto node11 = aabb1->_node(child11, node1);
+        _quantizedCollidingPrimitives(aabb0, child00, node00, aabb1, child10,
+                                      node10, batch);
+        _quantizedCollidingPrimitives(aabb0, child00, node00, aabb1, child11,
+                                      node11, batch);
+        _quantizedCollidingPrimitives(aabb0, child01, node01, aabb1, child10,
+                                      node10, batch);
+        _quantizedCollidingPrimitives(aabb0, child01, node01, aabb1, child11,
+                                      node11, batch);
+    }
+    else if (!node0.isLeaf())
+    {
+        _quantizedCollidingPrimitives(aabb0, id0 + 1,
+                                      aabb0->_node(id0 + 1, node0), aabb1,
+                                      id1, node1, batch);
+        _quantizedCollidingPrimitives(aabb0, node0.offset,
+                                      aabb0->_node(node0.offset, node0),
+                                      aabb1, id1, node1, batch);
+    }
+    else if (!node1.isLeaf())
+    {
+        _quantizedCollidingPrimitives(aabb0, id0, node0, aabb1, id1 + 1,
+                                      aabb1->_node(id1 + 1, node1), batch);
+        _quantizedCollidingPrimitives(aabb0, id0, node0, aabb1, node1.offset,
+                                      aabb1->_node(node1.offset, node1),
+                                      batch);
+    }
+    else
+    {
+        auto& primitives0 = aabb0->_primitives;
+        auto& primitives1 = aabb1->_primitives;
+        for (uint32_t i = node0.offset; i < node0.offset + node0.size; ++i)
+            for (uint32_t j = node1.offset; j < node1.offset + node1.size; ++j)
+                _pushPair(primitives0[i], primitives1[j], batch);
+    }
+}
+
+void HierarchicalAABB::_collidingNodes(HierarchicalAABBPtr aabb0,
+                                       uint32_t id0,
+                                       HierarchicalAABBPtr aabb1,
+                                       uint32_t id1,
+                                       uint32_t depth,
+                                       IndexPairs& nodePairs)
+{
+    auto& node0 = aabb0->_nodes[id0];
+    auto& node1 = aabb1->_nodes[id1];
+    if (!node0.isColliding(node1)) return;
+
+    if (depth == 0 || (node0.isLeaf() && node1.isLeaf()))
+    {
+        nodePairs.push_back(std::make_pair(id0, id1));
+        return;
+    }
+    --depth;
+    if (!node0.isLeaf() && !node1.isLeaf())
+    {
+        _collidingNodes(aabb0, id0 + 1, aabb1, id1 + 1, depth, nodePairs);
+        _collidingNodes(aabb0, id0 + 1, aabb1, node1.offset, depth, nodePairs);
+        _collidingNodes(aabb0, node0.offset, aabb1, id1 + 1, depth, nodePairs);
+        _collidingNodes(aabb0, node0.offset, aabb1, node1.offset, depth,
+                        nodePairs);
+    }
+    else if (!node0.isLeaf())
+    {
+        _collidingNodes(aabb0, id0 + 1, aabb1, id1, depth, nodePairs);
+        _collidingNodes(aabb0, node0.offset, aabb1, id1, depth, nodePairs);
+    }
+    else
+    {
+        _collidingNodes(aabb0, id0, aabb1, id1 + 1, depth, nodePairs);
+        _collidingNodes(aabb0, id0, aabb1, node1.offset, depth, nodePairs);
+    }
+}
+
+void HierarchicalAABB::_selfCollidingPrimitives(uint32_t id,
+                                                PrimitivePairBatch& batch)
+{
+    auto& node = _nodes[id];
+    if (node.isLeaf())
+    {
+        uint32_t end = node.offset + node.size;
+        for (uint32_t i = node.offset; i < end; ++i)
+            for (uint32_t j = i + 1; j < end; ++j)
+                _pushPair(_primitives[i], _primitives[j], batch);
+        return;
+    }
+
+    // Pairs within each child, then the pairs between both children
+    _selfCollidingPrimitives(id + 1, batch);
+    _selfCollidingPrimitives(node.offset, batch);
+    _collidingPrimitives(this, id + 1, this, node.offset, batch);
+}
+
+void HierarchicalAABB::_quantizedSelfCollidingPrimitives(
+    uint32_t id,
+    const HierarchicalAABBNode& node,
+    PrimitivePairBatch& batch)
+{
+    if (node.isLeaf())
+    {
+        uint32_t end = node.offset + node.size;
+        for (uint32_t i = node.offset; i < end; ++i)
+            for (uint32_t j = i + 1; j < end; ++j)
+                _pushPair(_primitives[i], _primitives[j], batch);
+        return;
+    }
+
+    auto child0 = _node(id + 1, node);
+    auto child1 = _node(node.offset, node);
+    _quantizedSelfCollidingPrimitives(id + 1, child0, batch);
+    _quantizedSelfCollidingPrimitives(node.offset, child1, batch);
+    _quantizedCollidingPrimitives(this, id + 1, child0, this, node.offset,
+                                  child1, batch);
+}
+
+void HierarchicalAABB::_selfCollidingNodes(uint32_t id,
+                                           uint32_t depth,
+                                           IndexPairs& nodePairs)
+{
+    auto& node = _nodes[id];
+    if (depth == 0 || node.isLeaf())
+    {
+        nodePairs.push_back(std::make_pair(id, id));
+        return;
+    }
+    --depth;
+    _selfCollidingNodes(id + 1, depth, nodePairs);
+    _selfCollidingNodes(node.offset, depth, nodePairs);
+    _collidingNodes(this, id + 1, this, node.offset, depth, nodePairs);
+}
+
+void HierarchicalAABB::_pushPair(PrimitivePtr primitive0,
+                                 PrimitivePtr primitive1,
+                                 PrimitivePairBatch& batch)
+{
+    if (!primitive0->areLimitsColliding(primitive1, batch.margin)) return;
+    if (batch.skipAdjacent && primitive0->sharesNode(primitive1)) return;
+    batch.pairs[batch.size] = std::make_pair(primitive0, primitive1);
+    if (++batch.size == HIERARCHICAL_AABB_PAIR_BATCH_SIZE)
+    {
+        (*batch.callback)(batch.pairs, batch.size);
+        batch.size = 0;
+    }
+}
+
 }  // namespace geometry
-}  // namespace phyanim
\ No newline at end of file
+}  // namespace phyanim
@@ -18,9 +18,16 @@
 #ifndef __PHYANIM_HIERARCHICAL_AABB__
 #define __PHYANIM_HIERARCHICAL_AABB__
 
+#include <atomic>
+#include <functional>
+#include <future>
+
 #include "AxisAlignedBoundingBox.h"
 #include "Edge.h"
 
+#define HIERARCHICAL_AABB_PAIR_BATCH_SIZE 256
+#define HIERARCHICAL_AABB_QUANTIZED_LEAF 0x80000000u
+
 namespace phyanim
 {
 namespace geometry
@@ -31,19 +38,103 @@ typedef HierarchicalAABB* HierarchicalAABBPtr;
 
 typedef std::vector<HierarchicalAABBPtr> HierarchicalAABBs;
 
+typedef std::pair<uint32_t, uint32_t> IndexPair;
+
+typedef std::vector<IndexPair> IndexPairs;
+
+typedef enum
+{
+    MIDPOINT = 0,
+    MEDIAN,
+    SAH
+} SplitMethod;
+
+typedef struct
+{
+    uint32_t numNodes;
+    uint32_t numLeaves;
+    uint32_t maxDepth;
+    float meanDepth;
+    uint32_t minLeafSize;
+    uint32_t maxLeafSize;
+    float meanLeafSize;
+    float sahCost;
+} HierarchicalAABBStats;
+
+struct HierarchicalAABBNode
+{
+    bool isLeaf() const { return size > 0; };
+
+    bool isColliding(const HierarchicalAABBNode& other,
+                     float margin = 0.0f) const
+    {
+        return (lowerLimit.x <= other.upperLimit.x + margin) &&
+               (upperLimit.x + margin >= other.lowerLimit.x) &&
+               (lowerLimit.y <= other.upperLimit.y + margin) &&
+               (upperLimit.y + margin >= other.lowerLimit.y) &&
+               (lowerLimit.z <= other.upperLimit.z + margin) &&
+               (upperLimit.z + margin >= other.lowerLimit.z);
+    };
+
+    Vec3 lowerLimit;
+
+    Vec3 upperLimit;
+
+    // Inner nodes store the index of their second child, the first one is
+    // the next node. Leaves store the index of their first primitive.
+    uint32_t offset;
+
+    // Number of primitives of a leaf, zero for inner nodes
+    uint32_t size;
+};
+
+typedef std::vector<HierarchicalAABBNode> HierarchicalAABBNodes;
+
+// Limits are stored in 1/65535 units of the parent box, rounded outwards
+struct QuantizedHierarchicalAABBNode
+{
+    bool isLeaf() const { return data & HIERARCHICAL_AABB_QUANTIZED_LEAF; };
+
+    uint16_t lowerLimit[3];
+
+    uint16_t upperLimit[3];
+
+    // Leaves set the highest bit, store their size in the next 7 bits and
+    // their first primitive in the lowest 24. Inner nodes store the index of
+    // their second child
+    uint32_t data;
+};
+
+typedef std::vector<QuantizedHierarchicalAABBNode>
+    QuantizedHierarchicalAABBNodes;
+
+// Receives a batch of primitive pairs with colliding limits. The pairs are
+// only valid during the call
+typedef std::function<void(const PrimitivePair* pairs, uint32_t size)>
+    PrimitivePairsCallback;
+
 class HierarchicalAABB : public AxisAlignedBoundingBox
 {
 public:
     HierarchicalAABB();
 
-    HierarchicalAABB(Primitives& primitives, uint64_t cellSize = 10);
+    HierarchicalAABB(Primitives& primitives,
+                     uint64_t cellSize = 10,
+                     SplitMethod splitMethod = MIDPOINT);
 
-    HierarchicalAABB(Edges& edges, uint64_t cellSize = 10);
+    HierarchicalAABB(Edges& edges,
+                     uint64_t cellSize = 10,
+                     SplitMethod splitMethod = MIDPOINT);
 
     ~HierarchicalAABB();
 
     void update();
 
+    // Refits the leaves of the dirty nodes and their ancestors, without
+    // visiting the clean subtrees, and returns the number of BVH nodes
+    // refitted. Dirty flags are left for the caller to clear.
+    uint32_t refit();
+
     Nodes outterNodes(const AxisAlignedBoundingBox& axisAlignedBoundingBox);
 
     Primitives insidePrimitives(
@@ -52,33 +143,275 @@ public:
         const AxisAlignedBoundingBox& axisAlignedBoundingBox);
     PrimitivePairs collidingPrimitives(HierarchicalAABBPtr hierarchicalAABB);
 
+    // Streams the primitive pairs with colliding limits in fixed size
+    // batches, without storing all of them. Limits closer than the margin
+    // are also considered colliding
+    void collidingPrimitives(HierarchicalAABBPtr hierarchicalAABB,
+                             const PrimitivePairsCallback& callback,
+                             float margin = 0.0f);
+
+    // Same as above starting from a pair of nodes of both trees
+    void collidingPrimitives(HierarchicalAABBPtr hierarchicalAABB,
+                             uint32_t id0,
+                             uint32_t id1,
+                             const PrimitivePairsCallback& callback,
+                             float margin = 0.0f);
+
+    // Colliding node pairs reached descending at most depth levels, in
+    // traversal order. Streaming the primitives of every pair covers the
+    // same pairs as streaming from the roots
+    IndexPairs collidingNodes(HierarchicalAABBPtr hierarchicalAABB,
+                              uint32_t depth);
+
+    // Streams the unordered pairs of different primitives of this tree with
+    // colliding limits, skipping the pairs that share a node
+    void selfCollidingPrimitives(const PrimitivePairsCallback& callback);
+
+    // Same as above for the pairs within a node, when both ids are equal, or
+    // between two disjoint nodes
+    void selfCollidingPrimitives(uint32_t id0,
+                                 uint32_t id1,
+                                 const PrimitivePairsCallback& callback);
+
+    // Node pairs reached descending at most depth levels of the self
+    // traversal. Streaming the self colliding primitives of every pair covers
+    // the same pairs as streaming from the root
+    IndexPairs selfCollidingNodes(uint32_t depth);
+
+    // Stores the nodes with 16 bit limits relative to their parent, halving
+    // the memory of the tree. Meant for static geometry: pairs are streamed
+    // from any pair of nodes, decoding their ancestors, and any other query
+    // or update decompresses the tree.
+    // Returns false if the leaves or primitives can not be encoded
+    bool compress();
+
+    void decompress();
+
+    bool compressed() const;
+
+    // Bytes used by the nodes
+    uint64_t nodesMemory() const;
+
     Edges insideEdges(const AxisAlignedBoundingBox& axisAlignedBoundingBox);
     Edges collidingEdges(const AxisAlignedBoundingBox& axisAlignedBoundingBox);
 
+    uint32_t numNodes() const;
+
+    const Primitives& primitives() const;
+
+    HierarchicalAABBStats stats() const;
+
+    float sahCost() const;
+
+    // Current SAH cost relative to the cost right after the last build
+    float sahCostRatio() const;
+
+    // Rebuild when sahCostRatio() exceeds this value, zero disables it
+    float rebuildThreshold;
+
+    // Build the new tree in a background thread and swap it in once ready.
+    // A single tree is rebuilt in the background at a time
+    bool asyncRebuild;
+
+    // Primitive limits enclose the whole motion of the last step, as
+    // needed by the continuous collision detection
+    bool swept;
+
+    // Leaves are enlarged by this margin and refit() only updates them once
+    // a primitive leaves its box. It applies to the whole tree after the next
+    // build or update()
+    float margin;
+
 protected:
+    typedef struct BuildNode
+    {
+        Vec3 lowerLimit;
+        Vec3 upperLimit;
+        uint32_t begin;
+        uint32_t end;
+        int32_t child0;
+        int32_t child1;
+    } BuildNode;
+
+    typedef std::vector<BuildNode> BuildNodes;
+
+    typedef struct BuildPrimitive
+    {
+        Vec3 lowerLimit;
+        Vec3 upperLimit;
+        Vec3 center;
+        uint32_t id;
+    } BuildPrimitive;
+
+    typedef std::vector<BuildPrimitive> BuildPrimitives;
+
+    typedef struct PrimitivePairBatch
+    {
+        PrimitivePair pairs[HIERARCHICAL_AABB_PAIR_BATCH_SIZE];
+        uint32_t size;
+        const PrimitivePairsCallback* callback;
+        // Skip the pairs of primitives sharing a node
+        bool skipAdjacent;
+        float margin;
+    } PrimitivePairBatch;
+
+    // Snapshot of the primitive bounds the tree is built from
+    typedef struct BuildData
+    {
+        BuildPrimitives primitives;
+        BuildNodes nodes;
+        std::atomic<uint32_t> numNodes;
+        uint64_t cellSize;
+        SplitMethod splitMethod;
+    } BuildData;
+
+    void _build();
+
     void _update();
 
-    void _divide(Primitives& primitives, uint64_t cellSize);
+    BuildData* _snapshot() const;
+
+    void _install(BuildData& data);
+
+    bool _checkRebuild();
+
+    float _rootArea() const;
+
+    static void _buildTree(BuildData& data, bool parallel = true);
+
+    static void _divide(BuildData& data,
+                        uint32_t id,
+                        uint32_t begin,
+                        uint32_t end);
+
+    static uint32_t _split(BuildData& data,
+                           uint32_t begin,
+                           uint32_t end,
+                           const Vec3& lowerLimit,
+                           const Vec3& upperLimit,
+                           const Vec3& lowerCenter,
+                           const Vec3& upperCenter);
+
+    static uint32_t _sahSplit(BuildData& data,
+                              uint32_t begin,
+                              uint32_t end,
+                              const Vec3& lowerCenter,
+                              const Vec3& upperCenter);
+
+    uint32_t _flatten(const BuildNodes& buildNodes, uint32_t id);
+
+    void _buildRefitMap();
+
+    void _clearRefitMap();
+
+    bool _refitNode(uint32_t id, float& sahDelta);
+
+    void _compress(uint32_t id, const HierarchicalAABBNode& parent);
+
+    HierarchicalAABBNode _rootNode() const;
+
+    HierarchicalAABBNode _node(uint32_t id,
+                               const HierarchicalAABBNode& parent) const;
 
-    void _outterNodes(const AxisAlignedBoundingBox& aabb, Nodes& nodes);
+    // Node at any id, decoding the limits of its ancestors when compressed
+    HierarchicalAABBNode _decodedNode(uint32_t id) const;
 
-    void _insidePrimitives(const AxisAlignedBoundingBox& axisAlignedBoundingBox,
+    float _quantizedCost(uint32_t id,
+                         const HierarchicalAABBNode& parent) const;
+
+    void _stats(uint32_t id,
+                const HierarchicalAABBNode& node,
+                uint32_t depth,
+                HierarchicalAABBStats& stats) const;
+
+    void _outterNodes(uint32_t id,
+                      const AxisAlignedBoundingBox& aabb,
+                      Nodes& nodes);
+
+    void _insidePrimitives(uint32_t id,
+                           const AxisAlignedBoundingBox& aabb,
                            Primitives& primitives);
 
-    void _collidingPrimitives(
-        const AxisAlignedBoundingBox& axisAlignedBoundingBox,
-        Primitives& primitives);
+    void _collidingPrimitives(uint32_t id,
+                              const AxisAlignedBoundingBox& aabb,
+                              Primitives& primitives);
+
+    static void _collidingPrimitives(HierarchicalAABBPtr aabb0,
+                                     uint32_t id0,
+                                     HierarchicalAABBPtr aabb1,
+                                     uint32_t id1,
+                                     PrimitivePairs& primitivePairs);
+
+    static void _collidingPrimitives(HierarchicalAABBPtr aabb0,
+                                     uint32_t id0,
+                                     HierarchicalAABBPtr aabb1,
+                                     uint32_t id1,
+                                     PrimitivePairBatch& batch);
+
+    static void _collidingNodes(HierarchicalAABBPtr aabb0,
+                                uint32_t id0,
+                                HierarchicalAABBPtr aabb1,
+                                uint32_t id1,
+                                uint32_t depth,
+                                IndexPairs& nodePairs);
 
-    void _collidingPrimitives(HierarchicalAABBPtr aabb0,
-                              HierarchicalAABBPtr aabb1,
-                              PrimitivePairs& primitivePairs);
+    static void _quantizedCollidingPrimitives(
+        HierarchicalAABBPtr aabb0,
+        uint32_t id0,
+        const HierarchicalAABBNode& node0,
+        HierarchicalAABBPtr aabb1,
+        uint32_t id1,
+        const HierarchicalAABBNode& node1,
+        PrimitivePairBatch& batch);
+
+    void _selfCollidingPrimitives(uint32_t id, PrimitivePairBatch& batch);
+
+    void _quantizedSelfCollidingPrimitives(uint32_t id,
+                                           const HierarchicalAABBNode& node,
+                                           PrimitivePairBatch& batch);
+
+    void _selfCollidingNodes(uint32_t id,
+                             uint32_t depth,
+                             IndexPairs& nodePairs);
+
+    static void _pushPair(PrimitivePtr primitive0,
+                          PrimitivePtr primitive1,
+                          PrimitivePairBatch& batch);
 
 protected:
+    // Nodes stored in depth first order
+    HierarchicalAABBNodes _nodes;
+
+    // Replaces _nodes while the tree is compressed
+    QuantizedHierarchicalAABBNodes _quantizedNodes;
+
+    // Primitives sorted so that every leaf references a contiguous range
     Primitives _primitives;
 
-    HierarchicalAABBPtr _child0;
+    uint64_t _cellSize;
+
+    SplitMethod _splitMethod;
+
+    // Mesh nodes of the primitives with the leaves referencing each one and
+    // the parent of every node, built on the first refit after a build
+    Nodes _refitNodes;
+
+    std::vector<uint32_t> _refitOffsets;
+
+    std::vector<uint32_t> _refitLeaves;
+
+    std::vector<uint32_t> _parents;
+
+    std::vector<uint8_t> _dirtyNodes;
+
+    float _builtSahCost;
+
+    // Unnormalized SAH cost kept up to date by update() and refit()
+    float _sahCostSum;
+
+    BuildData* _rebuildData;
 
-    HierarchicalAABBPtr _child1;
+    std::future<void> _rebuildFuture;
 };
 
 }  // namespace geometry
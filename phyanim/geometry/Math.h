@@ -54,6 +54,9 @@ void project(const Vec3& a,
              Vec3& p1,
              float& t1);
 
+// Closest point to p of the triangle abc
+Vec3 project(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c);
+
 }  // namespace geometry
 }  // namespace phyanim
 
@@ -27,6 +27,7 @@
 #include <iostream>
 #include <set>
 
+#include "PrimitiveNodes.h"
 #include "Tetrahedron.h"
 #include "Triangle.h"
 
@@ -45,15 +46,21 @@ Mesh::Mesh(float stiffness_,
     , density(density_)
     , damping(damping_)
     , poissonRatio(poissonRatio_)
+    , AMatrixRequestedSolverType(CG_SOLVER)
+    , AMatrixSolverType(CG_SOLVER)
+    , AMatrixSolverIterations(0)
+    , AMatrixSolverError(0.0f)
     , _normalsLoaded(false)
 {
 }
 
 Mesh::~Mesh(void)
 {
-    for (auto node : nodes) delete node;
+    for (auto node : nodes)
+        if (!arena.owns(node)) delete node;
     nodes.clear();
-    for (auto triangle : triangles) delete triangle;
+    for (auto triangle : triangles)
+        if (!arena.owns(triangle)) delete triangle;
     triangles.clear();
 }
 
@@ -114,16 +121,24 @@ void Mesh::load(const std::string& nodeFile_, const std::string& eleFile_)
 
 void Mesh::clearData()
 {
-    for (auto node : nodes) delete node;
+    // Loaded objects live in the arena, only the ones created elsewhere, as
+    // the triangles and edges derived from tetrahedra, are deleted
+    for (auto node : nodes)
+        if (!arena.owns(node)) delete node;
     nodes.clear();
-    for (auto triangle : triangles) delete triangle;
+    for (auto triangle : triangles)
+        if (!arena.owns(triangle)) delete triangle;
     triangles.clear();
     surfaceTriangles.clear();
-    for (auto tet : tetrahedra) delete tet;
+    for (auto tet : tetrahedra)
+        if (!arena.owns(tet)) delete tet;
     tetrahedra.clear();
-    for (auto edge : edges) delete edge;
+    for (auto edge : edges)
+        if (!arena.owns(edge)) delete edge;
     edges.clear();
+    arena.clear();
     if (boundingBox) delete boundingBox;
+    boundingBox = nullptr;
 }
 
 void Mesh::compute(bool createEdges)
@@ -324,6 +339,7 @@ void Mesh::nodesToInitPos()
     {
         auto node = nodes[i];
         node->position = node->initPosition;
+        node->dirty = true;
     }
 }
 
@@ -348,7 +364,7 @@ Mesh* Mesh::copy(bool surfaceTriangles_,
     std::unordered_map<Node*, Node*> nodesDicc;
     for (auto node : nodes)
     {
-        auto newNode = new Node(node->position, node->id);
+        auto newNode = mesh->arena.create<Node>(node->position, node->id);
         newNode->normal = node->normal;
         mesh->nodes.push_back(newNode);
         nodesDicc[node] = newNode;
@@ -358,9 +374,9 @@ Mesh* Mesh::copy(bool surfaceTriangles_,
         for (auto primitive : surfaceTriangles)
         {
             auto triangle = dynamic_cast<TrianglePtr>(primitive);
-            auto newTriangle = new Triangle(nodesDicc[triangle->node0],
-                                            nodesDicc[triangle->node1],
-                                            nodesDicc[triangle->node2]);
+            auto newTriangle = mesh->arena.create<Triangle>(
+                nodesDicc[triangle->node0], nodesDicc[triangle->node1],
+                nodesDicc[triangle->node2]);
             mesh->surfaceTriangles.push_back(newTriangle);
         }
     }
@@ -369,9 +385,9 @@ Mesh* Mesh::copy(bool surfaceTriangles_,
         for (auto primitive : triangles)
         {
             auto triangle = dynamic_cast<TrianglePtr>(primitive);
-            auto newTriangle = new Triangle(nodesDicc[triangle->node0],
-                                            nodesDicc[triangle->node1],
-                                            nodesDicc[triangle->node2]);
+            auto newTriangle = mesh->arena.create<Triangle>(
+                nodesDicc[triangle->node0], nodesDicc[triangle->node1],
+                nodesDicc[triangle->node2]);
             mesh->triangles.push_back(newTriangle);
         }
     }
@@ -381,8 +397,9 @@ Mesh* Mesh::copy(bool surfaceTriangles_,
         {
             auto tet = dynamic_cast<TetrahedronPtr>(primitive);
             PrimitivePtr newTet =
-                new Tetrahedron(nodesDicc[tet->node0], nodesDicc[tet->node1],
-                                nodesDicc[tet->node2], nodesDicc[tet->node3]);
+                mesh->arena.create<Tetrahedron>(
+                    nodesDicc[tet->node0], nodesDicc[tet->node1],
+                    nodesDicc[tet->node2], nodesDicc[tet->node3]);
             mesh->tetrahedra.push_back(newTet);
         }
     }
@@ -391,7 +408,8 @@ Mesh* Mesh::copy(bool surfaceTriangles_,
         for (auto edge : edges)
         {
             auto newEdge =
-                new Edge(nodesDicc[edge->node0], nodesDicc[edge->node1]);
+                mesh->arena.create<Edge>(nodesDicc[edge->node0],
+                                         nodesDicc[edge->node1]);
             mesh->edges.push_back(newEdge);
         }
     }
@@ -502,7 +520,7 @@ void Mesh::_loadOBJ(const std::string& file_)
                 float x = std::stof(strings[1]);
                 float y = std::stof(strings[2]);
                 float z = std::stof(strings[3]);
-                nodes.push_back(new Node(Vec3(x, y, z), id));
+                nodes.push_back(arena.create<Node>(Vec3(x, y, z), id));
             }
             else if ((strings[0].compare("f") == 0))
             {
@@ -528,12 +546,13 @@ void Mesh::_loadOBJ(const std::string& file_)
 
         for (auto triangle : bTriangles)
         {
-            triangles.push_back(new Triangle(
+            triangles.push_back(arena.create<Triangle>(
                 nodes[triangle.id0], nodes[triangle.id1], nodes[triangle.id2]));
             if (triangle.quad)
-                triangles.push_back(new Triangle(nodes[triangle.id0],
-                                                 nodes[triangle.id2],
-                                                 nodes[triangle.id3]));
+                triangles.push_back(
+                    arena.create<Triangle>(nodes[triangle.id0],
+                                           nodes[triangle.id2],
+                                           nodes[triangle.id3]));
         }
     }
 }
@@ -548,7 +567,7 @@ void Mesh::_loadOFF(const std::string& file_)
     for (size_t i = 0; i < nVertices; ++i)
     {
         auto v = vertices.row(i);
-        nodes[i] = new Node(Vec3(v.x(), v.y(), v.z()), i);
+        nodes[i] = arena.create<Node>(Vec3(v.x(), v.y(), v.z()), i);
     }
     size_t nFacets = facets.rows();
     bool quads = facets.cols() == 4;
@@ -559,11 +578,11 @@ void Mesh::_loadOFF(const std::string& file_)
     }
     for (size_t i = 0; i < nFacets; ++i)
     {
-        triangles[i] = new Triangle(nodes[facets(i, 0)], nodes[facets(i, 1)],
-                                    nodes[facets(i, 2)]);
+        triangles[i] = arena.create<Triangle>(
+            nodes[facets(i, 0)], nodes[facets(i, 1)], nodes[facets(i, 2)]);
         if (quads)
         {
-            triangles[nFacets + i] = new Triangle(
+            triangles[nFacets + i] = arena.create<Triangle>(
                 nodes[facets(i, 0)], nodes[facets(i, 3)], nodes[facets(i, 2)]);
         }
     }
@@ -579,7 +598,7 @@ void Mesh::_loadPLY(const std::string& file_)
     for (size_t i = 0; i < nVertices; ++i)
     {
         auto v = vertices.row(i);
-        nodes[i] = new Node(Vec3(v.x(), v.y(), v.z()), i);
+        nodes[i] = arena.create<Node>(Vec3(v.x(), v.y(), v.z()), i);
     }
     size_t nFacets = facets.rows();
     bool quads = facets.cols() == 4;
@@ -590,11 +609,11 @@ void Mesh::_loadPLY(const std::string& file_)
     }
     for (size_t i = 0; i < nFacets; ++i)
     {
-        triangles[i] = new Triangle(nodes[facets(i, 0)], nodes[facets(i, 1)],
-                                    nodes[facets(i, 2)]);
+        triangles[i] = arena.create<Triangle>(
+            nodes[facets(i, 0)], nodes[facets(i, 1)], nodes[facets(i, 2)]);
         if (quads)
         {
-            triangles[nFacets + i] = new Triangle(
+            triangles[nFacets + i] = arena.create<Triangle>(
                 nodes[facets(i, 0)], nodes[facets(i, 2)], nodes[facets(i, 3)]);
         }
     }
@@ -621,18 +640,18 @@ void Mesh::_loadTET(const std::string& file_)
                 _split(line, strs);
                 Vec3 pos(std::atof(strs[0].c_str()), std::atof(strs[1].c_str()),
                          std::atof(strs[2].c_str()));
-                nodes[i] = new Node(pos, i);
+                nodes[i] = arena.create<Node>(pos, i);
             }
             tetrahedra.resize(numTets);
             for (unsigned int i = 0; i < numTets; i++)
             {
                 std::getline(inFile, line);
                 _split(line, strs);
-                tetrahedra[i] =
-                    new Tetrahedron(nodes[std::atoi(strs[0].c_str())],
-                                    nodes[std::atoi(strs[1].c_str())],
-                                    nodes[std::atoi(strs[2].c_str())],
-                                    nodes[std::atoi(strs[3].c_str())]);
+                tetrahedra[i] = arena.create<Tetrahedron>(
+                    nodes[std::atoi(strs[0].c_str())],
+                    nodes[std::atoi(strs[1].c_str())],
+                    nodes[std::atoi(strs[2].c_str())],
+                    nodes[std::atoi(strs[3].c_str())]);
             }
             inFile.close();
         }
@@ -681,7 +700,7 @@ void Mesh::_loadTETGEN(const std::string& nodeFile_,
                         float zCoord;
                         sstream >> index >> xCoord >> yCoord >> zCoord;
                         Vec3 pos(xCoord, yCoord, zCoord);
-                        nodes[index] = new Node(pos, index);
+                        nodes[index] = arena.create<Node>(pos, index);
                     }
                 }
             }
@@ -714,8 +733,8 @@ void Mesh::_loadTETGEN(const std::string& nodeFile_,
                         uint64_t id2;
                         uint64_t id3;
                         sstream >> index >> id0 >> id1 >> id3 >> id2;
-                        auto tet = new Tetrahedron(nodes[id0], nodes[id1],
-                                                   nodes[id3], nodes[id2]);
+                        auto tet = arena.create<Tetrahedron>(
+                            nodes[id0], nodes[id1], nodes[id3], nodes[id2]);
                         tetrahedra[index] = tet;
                     }
                 }
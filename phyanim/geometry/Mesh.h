@@ -20,6 +20,8 @@
 
 #include <Eigen/Sparse>
 
+#include "Arena.h"
+#include "BlockSparseMatrix.h"
 #include "Edge.h"
 #include "HierarchicalAABB.h"
 
@@ -33,6 +35,29 @@ typedef Mesh* MeshPtr;
 
 typedef std::vector<MeshPtr> Meshes;
 
+typedef enum
+{
+    CG_SOLVER = 0,
+    ICCG_SOLVER,
+    LDLT_SOLVER,
+    AUTO_SOLVER,
+    MATRIX_FREE_SOLVER,
+    BLOCK_CG_SOLVER
+} SolverType;
+
+typedef Eigen::SparseMatrix<float> SparseMatrix;
+
+typedef Eigen::ConjugateGradient<SparseMatrix> CGSolver;
+
+typedef Eigen::ConjugateGradient<SparseMatrix,
+                                 Eigen::Lower,
+                                 Eigen::IncompleteCholesky<float>>
+    ICCGSolver;
+
+typedef Eigen::
+    SimplicialLDLT<SparseMatrix, Eigen::Lower, Eigen::AMDOrdering<int>>
+        LDLTSolver;
+
 class Mesh
 {
 public:
@@ -86,6 +111,9 @@ public:
 
     void computeNormals();
 
+    // Owns the nodes and primitives created by the loaders and copy
+    Arena arena;
+
     Nodes nodes;
 
     Primitives surfaceTriangles;
@@ -112,7 +140,38 @@ public:
 
     Eigen::SparseMatrix<float> kMatrix;
     Eigen::SparseMatrix<float> AMatrix;
-    Eigen::ConjugateGradient<Eigen::SparseMatrix<float>> AMatrixSolver;
+
+    // Backend requested when the mesh was preprocessed and backend used to
+    // solve AMatrix, only the matching solver is computed
+    SolverType AMatrixRequestedSolverType;
+    SolverType AMatrixSolverType;
+    CGSolver AMatrixSolver;
+    ICCGSolver AMatrixICCGSolver;
+    LDLTSolver AMatrixLDLTSolver;
+
+    // Iterations and estimated relative error of the last solve, zero for
+    // direct solvers
+    uint32_t AMatrixSolverIterations;
+    float AMatrixSolverError;
+
+    // Matrix free alternative to kMatrix and AMatrix: the 10 distinct 3x3
+    // stiffness blocks and the node ids of every tetrahedron. Tetrahedra are
+    // sorted by colour and the ones of the same colour share no nodes
+    AlignedFloats tetBlocks;
+    Indices tetNodeIds;
+    Indices tetColorOffsets;
+    AlignedFloats AMatrixDiagonal;
+
+    // Pattern of kMatrix and AMatrix, built once and refilled in parallel
+    // over the colours of tetNodeIds. Tetrahedra in colour order, offset of
+    // the 16 3x3 blocks of each one in the values and of every node diagonal
+    Indices tetOrder;
+    Indices kMatrixScatter;
+    Indices kMatrixDiagonalIds;
+
+    // Block compressed row alternative to kMatrix and AMatrix, A is applied
+    // from K and the masses
+    BlockSparseMatrix kBlockMatrix;
 
 private:
     void _split(const std::string& string_,
@@ -31,6 +31,7 @@ Node::Node(Vec3 position,
            bool fix)
     : initPosition(position)
     , position(position)
+    , prevPosition(position)
     , radius(radius)
     , normal(Vec3(0, 0, 1))
     , id(id)
@@ -42,6 +43,7 @@ Node::Node(Vec3 position,
     , isSoma(false)
     , anim(false)
     , collide(false)
+    , dirty(false)
 {
 }
 
@@ -67,6 +69,27 @@ void clearCollision(Nodes& nodes)
     for (uint32_t i = 0; i < size; ++i) nodes[i]->collide = false;
 }
 
+void clearDirty(Nodes& nodes)
+{
+    uint32_t size = nodes.size();
+
+    for (uint32_t i = 0; i < size; ++i) nodes[i]->dirty = false;
+}
+
+void limitDisplacement(Nodes& nodes)
+{
+    uint32_t size = nodes.size();
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        auto node = nodes[i];
+        Vec3 displacement = node->position - node->prevPosition;
+        float length = glm::length(displacement);
+        if (node->radius > 0.0f && length > node->radius)
+            node->position =
+                node->prevPosition + displacement * (node->radius / length);
+    }
+}
+
 void clearVelocityIfNoColl(Nodes& nodes)
 {
     uint32_t size = nodes.size();
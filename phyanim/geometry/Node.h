@@ -54,6 +54,10 @@ public:
 
     Vec3 position;
 
+    // Position before the last integration step, used by the continuous
+    // collision detection
+    Vec3 prevPosition;
+
     float radius;
 
     Vec3 normal;
@@ -75,12 +79,22 @@ public:
     bool anim;
 
     bool collide;
+
+    // Set when the position changes, cleared once the BVHs have been refitted
+    bool dirty;
 };
 
 void clearForce(Nodes& nodes);
 
 void clearCollision(Nodes& nodes);
 
+void clearDirty(Nodes& nodes);
+
+// Moves every node back along its last step so it moves at most its radius,
+// nodes without radius are left as they are. Capsules then can not pass
+// through each other in a single step
+void limitDisplacement(Nodes& nodes);
+
 void clearVelocityIfNoColl(Nodes& nodes);
 
 }  // namespace geometry
@@ -37,32 +37,52 @@ typedef std::pair<PrimitivePtr, PrimitivePtr> PrimitivePair;
 
 typedef std::vector<PrimitivePair> PrimitivePairs;
 
+typedef enum
+{
+    EDGE = 0,
+    TRIANGLE,
+    TETRAHEDRON
+} PrimitiveType;
+
+// Fixed capacity list of the nodes of a primitive, it does not allocate
+class PrimitiveNodes
+{
+public:
+    PrimitiveNodes() : _size(0){};
+
+    void push_back(NodePtr node) { _nodes[_size++] = node; };
+
+    const NodePtr* begin() const { return _nodes; };
+
+    const NodePtr* end() const { return _nodes + _size; };
+
+    size_t size() const { return _size; };
+
+    NodePtr operator[](size_t i) const { return _nodes[i]; };
+
+    operator Nodes() const { return Nodes(begin(), end()); };
+
+private:
+    NodePtr _nodes[4];
+
+    uint8_t _size;
+};
+
 class Primitive
 {
 public:
-    Primitive() : _lowerLimit(maxVec3), _upperLimit(minVec3){};
+    Primitive(PrimitiveType type)
+        : _lowerLimit(maxVec3)
+        , _upperLimit(minVec3)
+        , _type(type){};
 
     virtual ~Primitive(){};
 
-    void update()
-    {
-        _lowerLimit = maxVec3;
-        _upperLimit = minVec3;
-        for (auto node : nodes())
-        {
-            Vec3 pos = node->position;
-            float r = node->radius;
-            // _lowerLimit.x() = std::min(pos.x - r, _lowerLimit.x());
-            // _lowerLimit.y() = std::min(pos.y - r, _lowerLimit.y());
-            // _lowerLimit.z() = std::min(pos.z - r, _lowerLimit.z());
-            // _upperLimit.x() = std::max(pos.x + r, _upperLimit.x());
-            // _upperLimit.y() = std::max(pos.y + r, _upperLimit.y());
-            // _upperLimit.z() = std::max(pos.z + r, _upperLimit.z());
-
-            _lowerLimit = glm::min(pos - r, _lowerLimit);
-            _upperLimit = glm::max(pos + r, _upperLimit);
-        }
-    };
+    // The members reading the nodes are defined in PrimitiveNodes.h, which
+    // has to be included to call them
+
+    // Swept limits also enclose the nodes previous positions
+    inline void update(bool swept = false);
 
     Vec3 lowerLimit() const { return _lowerLimit; };
 
@@ -70,14 +90,18 @@ public:
 
     Vec3 center() const { return (_lowerLimit + _upperLimit) * 0.5f; };
 
-    virtual Nodes nodes() const = 0;
+    PrimitiveType type() const { return _type; };
 
-    bool areLimitsColliding(PrimitivePtr primitive) const
+    inline PrimitiveNodes nodes() const;
+
+    inline bool dirty() const;
+
+    bool areLimitsColliding(PrimitivePtr primitive, float margin = 0.0f) const
     {
         Vec3 thisLowerLimit = lowerLimit();
-        Vec3 thisUpperLimit = upperLimit();
+        Vec3 thisUpperLimit = upperLimit() + margin;
         Vec3 otherLowerLimit = primitive->lowerLimit();
-        Vec3 otherUpperLimit = primitive->upperLimit();
+        Vec3 otherUpperLimit = primitive->upperLimit() + margin;
 
         return (thisLowerLimit.x <= otherUpperLimit.x) &&
                (thisUpperLimit.x >= otherLowerLimit.x) &&
@@ -87,17 +111,18 @@ public:
                (thisUpperLimit.z >= otherLowerLimit.z);
     };
 
-    bool isSoma()
-    {
-        bool isSoma = true;
-        for (auto node : nodes()) isSoma = isSoma && node->isSoma;
-        return isSoma;
-    }
+    // True when both primitives are adjacent, they should not be tested for
+    // self collisions
+    inline bool sharesNode(PrimitivePtr primitive) const;
+
+    inline bool isSoma();
 
 protected:
     Vec3 _lowerLimit;
 
     Vec3 _upperLimit;
+
+    PrimitiveType _type;
 };
 
 }  // namespace geometry
@@ -0,0 +1,108 @@
+/* Copyright (c) 2020-2024, EPFL/Blue Brain Project
+ * All rights reserved. Do not distribute without permission.
+ * Responsible author: Juan Jose Garcia <juanjose.garcia@epfl.ch>
+ * This file is part of PhyAnim <https://github.com/BlueBrain/PhyAnim>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PHYANIM_PRIMITIVE_NODES__
+#define __PHYANIM_PRIMITIVE_NODES__
+
+#include "Edge.h"
+#include "Tetrahedron.h"
+#include "Triangle.h"
+
+namespace phyanim
+{
+namespace geometry
+{
+inline PrimitiveNodes Primitive::nodes() const
+{
+    PrimitiveNodes nodes;
+    switch (_type)
+    {
+    case EDGE:
+    {
+        auto edge = static_cast<const Edge*>(this);
+        nodes.push_back(edge->node0);
+        nodes.push_back(edge->node1);
+        break;
+    }
+    case TRIANGLE:
+    {
+        auto triangle = static_cast<const Triangle*>(this);
+        nodes.push_back(triangle->node0);
+        nodes.push_back(triangle->node1);
+        nodes.push_back(triangle->node2);
+        break;
+    }
+    case TETRAHEDRON:
+    {
+        auto tetrahedron = static_cast<const Tetrahedron*>(this);
+        nodes.push_back(tetrahedron->node0);
+        nodes.push_back(tetrahedron->node1);
+        nodes.push_back(tetrahedron->node2);
+        nodes.push_back(tetrahedron->node3);
+        break;
+    }
+    }
+    return nodes;
+}
+
+inline bool Primitive::sharesNode(PrimitivePtr primitive) const
+{
+    auto nodes0 = nodes();
+    auto nodes1 = primitive->nodes();
+    for (auto node0 : nodes0)
+        for (auto node1 : nodes1)
+            if (node0 == node1) return true;
+    return false;
+}
+
+
+inline void Primitive::update(bool swept)
+{
+    _lowerLimit = maxVec3;
+    _upperLimit = minVec3;
+    for (auto node : nodes())
+    {
+        _lowerLimit = glm::min(node->position - node->radius, _lowerLimit);
+        _upperLimit = glm::max(node->position + node->radius, _upperLimit);
+        if (swept)
+        {
+            _lowerLimit =
+                glm::min(node->prevPosition - node->radius, _lowerLimit);
+            _upperLimit =
+                glm::max(node->prevPosition + node->radius, _upperLimit);
+        }
+    }
+}
+
+inline bool Primitive::dirty() const
+{
+    for (auto node : nodes())
+        if (node->dirty) return true;
+    return false;
+}
+
+inline bool Primitive::isSoma()
+{
+    bool isSoma = true;
+    for (auto node : nodes()) isSoma = isSoma && node->isSoma;
+    return isSoma;
+}
+
+}  // namespace geometry
+}  // namespace phyanim
+
+#endif  // __PHYANIM_PRIMITIVE_NODES__
@@ -19,12 +19,15 @@
 
 #include <iostream>
 
+#include "PrimitiveNodes.h"
+
 namespace phyanim
 {
 namespace geometry
 {
 Tetrahedron::Tetrahedron(Node* n0_, Node* n1_, Node* n2_, Node* n3_)
-    : node0(n0_)
+    : Primitive(TETRAHEDRON)
+    , node0(n0_)
     , node1(n1_)
     , node2(n2_)
     , node3(n3_)
@@ -61,15 +64,6 @@ float Tetrahedron::volume() const
     return std::abs(glm::determinant(basis) / 6.0f);
 }
 
-Nodes Tetrahedron::nodes() const
-{
-    Nodes nodes(4);
-    nodes[0] = node0;
-    nodes[1] = node1;
-    nodes[2] = node2;
-    nodes[3] = node3;
-    return nodes;
-}
 Edges Tetrahedron::edges() const
 {
     Edges edges(6);
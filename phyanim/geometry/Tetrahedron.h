@@ -50,8 +50,6 @@ public:
 
     float volume() const;
 
-    Nodes nodes() const;
-
     Edges edges() const;
 
     Triangles triangles();
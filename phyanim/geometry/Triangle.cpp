@@ -17,12 +17,15 @@
 
 #include "Triangle.h"
 
+#include "PrimitiveNodes.h"
+
 namespace phyanim
 {
 namespace geometry
 {
 Triangle::Triangle(Node* n0_, Node* n1_, Node* n2_)
-    : node0(n0_)
+    : Primitive(TRIANGLE)
+    , node0(n0_)
     , node1(n1_)
     , node2(n2_)
 {
@@ -31,15 +34,6 @@ Triangle::Triangle(Node* n0_, Node* n1_, Node* n2_)
 
 Triangle::~Triangle() {}
 
-Nodes Triangle::nodes() const
-{
-    Nodes nodes(3);
-    nodes[0] = node0;
-    nodes[1] = node1;
-    nodes[2] = node2;
-    return nodes;
-}
-
 Edges Triangle::edges() const
 {
     Edges edges(3);
@@ -55,8 +55,6 @@ public:
 
     virtual ~Triangle();
 
-    Nodes nodes() const;
-
     Edges edges() const;
 
     float area() const;
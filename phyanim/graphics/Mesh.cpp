@@ -19,6 +19,8 @@
 
 #include <GL/glew.h>
 
+#include "../geometry/PrimitiveNodes.h"
+
 namespace phyanim
 {
 namespace graphics